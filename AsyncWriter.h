@@ -0,0 +1,241 @@
+#ifndef ASYNCWRITER_H_
+#define ASYNCWRITER_H_
+
+/**
+Writes output files on a background thread, so that the thread producing the output does not wait for the disk.
+
+Output is handed over in chunks of CHUNK_SIZE bytes and written in the order it was handed over, so every file
+receives exactly the bytes written to it. At most maxChunks chunks exist at any time, a producer which is
+faster than the disk waits; every open AsyncFileBuf holds one, so maxChunks must be larger than their number.
+Without a thread (threaded = false) chunks are written at once, which still saves the many small writes of
+line by line output.
+
+AsyncFileBuf puts a std::ostream on top of an AsyncWriter. Its sync() does not force a write, so std::endl
+does not cost a system call per line; data reaches the file when a chunk is full or the buffer is closed.
+tellp() works (it returns the number of bytes written so far), seeking does not.
+ */
+
+#include<cstdio>
+#include<cassert>
+#include<string>
+#include<vector>
+#include<deque>
+#include<ios>
+#include<streambuf>
+#include<pthread.h>
+
+#include "utils.h"
+#include "my_assert.h"
+
+class AsyncWriter {
+public:
+	static const int CHUNK_SIZE = 1 << 20;
+
+	AsyncWriter(bool threaded, int maxChunks = 32);
+	~AsyncWriter(); // writes everything pending
+
+	// a chunk to fill; empty, with CHUNK_SIZE bytes reserved
+	std::vector<char>* getChunk();
+
+	// write chunk to fo after everything handed over before, then recycle it; closeFile : close fo afterwards (chunk may be NULL then)
+	void submit(FILE* fo, std::vector<char>* chunk, bool closeFile = false);
+
+	// wait until everything handed over is written
+	void flush();
+
+private:
+	struct Job {
+		FILE *fo;
+		std::vector<char> *chunk;
+		bool closeFile;
+	};
+
+	bool threaded;
+	int maxChunks, nChunks; // nChunks : chunks created so far
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t jobAdded, jobDone;
+	std::deque<Job> jobs;
+	std::vector<std::vector<char>*> freeChunks;
+	bool busy, stop;
+
+	static void* writerLoop(void*);
+	void doJob(const Job&);
+};
+
+AsyncWriter::AsyncWriter(bool threaded, int maxChunks) {
+	assert(maxChunks > 0);
+	this->threaded = threaded;
+	this->maxChunks = maxChunks;
+	nChunks = 0;
+	busy = stop = false;
+
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&jobAdded, NULL);
+	pthread_cond_init(&jobDone, NULL);
+
+	if (threaded) {
+		int rc = pthread_create(&thread, NULL, writerLoop, (void*)this);
+		pthread_assert(rc, "pthread_create", "Cannot create the writer thread!");
+	}
+}
+
+AsyncWriter::~AsyncWriter() {
+	if (threaded) {
+		pthread_mutex_lock(&lock);
+		stop = true;
+		pthread_cond_signal(&jobAdded);
+		pthread_mutex_unlock(&lock);
+
+		int rc = pthread_join(thread, NULL);
+		pthread_assert(rc, "pthread_join", "Cannot join the writer thread!");
+	}
+	assert(jobs.empty());
+
+	pthread_mutex_destroy(&lock);
+	pthread_cond_destroy(&jobAdded);
+	pthread_cond_destroy(&jobDone);
+
+	for (int i = 0; i < (int)freeChunks.size(); i++) delete freeChunks[i];
+}
+
+std::vector<char>* AsyncWriter::getChunk() {
+	std::vector<char> *chunk = NULL;
+
+	pthread_mutex_lock(&lock);
+	while (freeChunks.empty() && nChunks >= maxChunks) pthread_cond_wait(&jobDone, &lock);
+	if (!freeChunks.empty()) { chunk = freeChunks.back(); freeChunks.pop_back(); }
+	else ++nChunks;
+	pthread_mutex_unlock(&lock);
+
+	if (chunk == NULL) { chunk = new std::vector<char>(); chunk->reserve(CHUNK_SIZE); }
+
+	return chunk;
+}
+
+void AsyncWriter::submit(FILE* fo, std::vector<char>* chunk, bool closeFile) {
+	Job job;
+
+	job.fo = fo; job.chunk = chunk; job.closeFile = closeFile;
+	if (!threaded) { doJob(job); return; }
+
+	pthread_mutex_lock(&lock);
+	jobs.push_back(job);
+	pthread_cond_signal(&jobAdded);
+	pthread_mutex_unlock(&lock);
+}
+
+void AsyncWriter::flush() {
+	pthread_mutex_lock(&lock);
+	while (!jobs.empty() || busy) pthread_cond_wait(&jobDone, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+void* AsyncWriter::writerLoop(void* arg) {
+	AsyncWriter *writer = (AsyncWriter*)arg;
+	Job job;
+
+	pthread_mutex_lock(&writer->lock);
+	while (true) {
+		while (writer->jobs.empty() && !writer->stop) pthread_cond_wait(&writer->jobAdded, &writer->lock);
+		if (writer->jobs.empty()) break; // stop, and nothing left to write
+
+		job = writer->jobs.front();
+		writer->jobs.pop_front();
+		writer->busy = true;
+		pthread_mutex_unlock(&writer->lock);
+
+		writer->doJob(job);
+
+		pthread_mutex_lock(&writer->lock);
+		writer->busy = false;
+		pthread_cond_broadcast(&writer->jobDone);
+	}
+	pthread_mutex_unlock(&writer->lock);
+
+	return NULL;
+}
+
+void AsyncWriter::doJob(const Job& job) {
+	if (job.chunk != NULL) {
+		if (!job.chunk->empty())
+			general_assert(fwrite(&(*job.chunk)[0], 1, job.chunk->size(), job.fo) == job.chunk->size(), "Fail to write output, the disk may be full!");
+		job.chunk->clear();
+
+		pthread_mutex_lock(&lock);
+		freeChunks.push_back(job.chunk);
+		pthread_mutex_unlock(&lock);
+	}
+	if (job.closeFile) general_assert(fclose(job.fo) == 0, "Fail to write output, the disk may be full!");
+}
+
+class AsyncFileBuf : public std::streambuf {
+public:
+	// closeFile : close fo when the buffer is closed
+	AsyncFileBuf(AsyncWriter* writer, FILE* fo, bool closeFile);
+	~AsyncFileBuf() { close(); }
+
+	// hand over what is left; the file is written (and closed) by the writer later, see AsyncWriter::flush
+	void close();
+
+protected:
+	int_type overflow(int_type c);
+	int sync() { return 0; }
+	pos_type seekoff(off_type off, std::ios_base::seekdir way, std::ios_base::openmode which);
+
+private:
+	AsyncWriter *writer;
+	FILE *fo;
+	bool closeFile;
+	std::vector<char> *chunk;
+	long long handed; // bytes handed over to the writer
+
+	void handOver();
+};
+
+AsyncFileBuf::AsyncFileBuf(AsyncWriter* writer, FILE* fo, bool closeFile) {
+	this->writer = writer;
+	this->fo = fo;
+	this->closeFile = closeFile;
+	chunk = NULL;
+	handed = 0;
+	handOver();
+}
+
+void AsyncFileBuf::handOver() {
+	if (chunk != NULL) {
+		chunk->resize(pptr() - pbase());
+		handed += chunk->size();
+		writer->submit(fo, chunk);
+	}
+	chunk = writer->getChunk();
+	chunk->resize(AsyncWriter::CHUNK_SIZE);
+	setp(&(*chunk)[0], &(*chunk)[0] + chunk->size());
+}
+
+AsyncFileBuf::int_type AsyncFileBuf::overflow(int_type c) {
+	if (fo == NULL) return traits_type::eof();
+	handOver();
+	if (!traits_type::eq_int_type(c, traits_type::eof())) {
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
+	}
+	return traits_type::not_eof(c);
+}
+
+// only answers where the output is (offset 0 from the current position)
+AsyncFileBuf::pos_type AsyncFileBuf::seekoff(off_type off, std::ios_base::seekdir way, std::ios_base::openmode which) {
+	if (off != 0 || way != std::ios_base::cur || !(which & std::ios_base::out) || fo == NULL) return pos_type(off_type(-1));
+	return pos_type(off_type(handed + (pptr() - pbase())));
+}
+
+void AsyncFileBuf::close() {
+	if (fo == NULL) return;
+	chunk->resize(pptr() - pbase());
+	writer->submit(fo, chunk, closeFile);
+	chunk = NULL;
+	fo = NULL;
+	setp(NULL, NULL);
+}
+
+#endif /* ASYNCWRITER_H_ */
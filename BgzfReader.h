@@ -0,0 +1,275 @@
+#ifndef BGZFREADER_H_
+#define BGZFREADER_H_
+
+/**
+Reads a BGZF compressed file (e.g. a BAM file) with several threads inflating blocks in parallel.
+
+A BGZF file is a series of independent gzip members (blocks) holding at most 64KB each. Threads take turns
+at the file: holding the lock, a thread reads the next block into a free slot, then it inflates the block
+without the lock. The consumer takes inflated blocks in file order, so read() returns exactly the bytes
+bgzf_read would. There are SLOTS_PER_THREAD slots per thread; inflating waits while all slots hold blocks
+the consumer has not taken yet.
+
+Only one thread may consume (read / readBam).
+ */
+
+#include<cstdio>
+#include<cstring>
+#include<cstdlib>
+#include<cassert>
+#include<string>
+#include<algorithm>
+#include<stdint.h>
+#include<pthread.h>
+#include<zlib.h>
+
+#include "sam/bam.h"
+
+#include "utils.h"
+#include "my_assert.h"
+
+class BgzfReader {
+public:
+	// offset : virtual file offset (as given by bgzf_tell) to start at, nThreads : number of inflating threads
+	BgzfReader(const char* fileF, int64_t offset, int nThreads);
+	~BgzfReader();
+
+	// copy the next length bytes into data, returns the number of bytes copied, less than length only at the end of the file
+	int read(void* data, int length);
+
+	// read the next BAM record, returns the same values as bam_read1; records must be little endian
+	int readBam(bam1_t* b);
+
+private:
+	static const int MAX_BLOCK_SIZE = 65536;
+	static const int HEADER_LENGTH = 18;
+	static const int SLOTS_PER_THREAD = 4;
+
+	struct Slot {
+		unsigned char comp[MAX_BLOCK_SIZE], data[MAX_BLOCK_SIZE];
+		int compLen, dataLen;
+		bool ready; // inflated, not yet released by the consumer
+	};
+
+	struct Worker {
+		BgzfReader *reader;
+		z_stream zs;
+	};
+
+	std::string fileName;
+	FILE *fi;
+	int nThreads, nSlots;
+	pthread_t *threads;
+	Worker *workers;
+	Slot *slots;
+
+	pthread_mutex_t lock;
+	pthread_cond_t slotFreed, blockReady;
+
+	long long nextRead; // sequence number of the next block to read from the file
+	long long cur; // sequence number of the block the consumer is on, its slot is not free
+	int pos; // position in the current block
+	bool started; // whether the consumer has taken its first block
+	bool eof, stop;
+	std::string error; // set by a thread which finds the file broken
+
+	static void* workerLoop(void*);
+
+	bool loadBlock(Slot&); // called with lock held, false at the end of the file or on error
+	bool inflateBlock(z_stream&, Slot&);
+	bool nextBlock(); // release the current block and wait for the next one, false at the end of the file
+};
+
+BgzfReader::BgzfReader(const char* fileF, int64_t offset, int nThreads) {
+	int rc;
+
+	assert(nThreads > 0);
+	fileName = fileF;
+	fi = fopen(fileF, "rb");
+	general_assert(fi != NULL, "Cannot open " + fileName + "! It may not exist.");
+	general_assert(fseeko(fi, (off_t)(offset >> 16), SEEK_SET) == 0, "Cannot seek in " + fileName + "!");
+
+	this->nThreads = nThreads;
+	nSlots = nThreads * SLOTS_PER_THREAD;
+	slots = new Slot[nSlots];
+	for (int i = 0; i < nSlots; i++) slots[i].ready = false;
+
+	nextRead = cur = 0;
+	pos = (int)(offset & 0xFFFF);
+	started = eof = stop = false;
+	error = "";
+
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&slotFreed, NULL);
+	pthread_cond_init(&blockReady, NULL);
+
+	threads = new pthread_t[nThreads];
+	workers = new Worker[nThreads];
+	for (int i = 0; i < nThreads; i++) {
+		workers[i].reader = this;
+		memset(&workers[i].zs, 0, sizeof(z_stream));
+		general_assert(inflateInit2(&workers[i].zs, -15) == Z_OK, "Cannot initialize zlib!");
+		rc = pthread_create(&threads[i], NULL, workerLoop, (void*)(&workers[i]));
+		pthread_assert(rc, "pthread_create", "Cannot create thread " + itos(i) + " (numbered from 0) for reading " + fileName + "!");
+	}
+}
+
+BgzfReader::~BgzfReader() {
+	int rc;
+
+	pthread_mutex_lock(&lock);
+	stop = true;
+	pthread_cond_broadcast(&slotFreed);
+	pthread_mutex_unlock(&lock);
+
+	for (int i = 0; i < nThreads; i++) {
+		rc = pthread_join(threads[i], NULL);
+		pthread_assert(rc, "pthread_join", "Cannot join thread " + itos(i) + " (numbered from 0) for reading " + fileName + "!");
+		inflateEnd(&workers[i].zs);
+	}
+
+	pthread_mutex_destroy(&lock);
+	pthread_cond_destroy(&slotFreed);
+	pthread_cond_destroy(&blockReady);
+
+	delete[] threads;
+	delete[] workers;
+	delete[] slots;
+	fclose(fi);
+}
+
+void* BgzfReader::workerLoop(void* arg) {
+	Worker *worker = (Worker*)arg;
+	BgzfReader *reader = worker->reader;
+	bool success;
+
+	pthread_mutex_lock(&reader->lock);
+	while (true) {
+		// the slot of block nextRead is free once the consumer is past block nextRead - nSlots
+		while (!reader->stop && !reader->eof && reader->nextRead - reader->cur >= reader->nSlots)
+			pthread_cond_wait(&reader->slotFreed, &reader->lock);
+		if (reader->stop || reader->eof) break;
+
+		Slot &slot = reader->slots[reader->nextRead % reader->nSlots];
+		if (!reader->loadBlock(slot)) {
+			reader->eof = true;
+			pthread_cond_broadcast(&reader->blockReady);
+			break;
+		}
+		++reader->nextRead;
+		pthread_mutex_unlock(&reader->lock);
+
+		success = reader->inflateBlock(worker->zs, slot);
+
+		pthread_mutex_lock(&reader->lock);
+		if (!success && reader->error == "") reader->error = "Fail to inflate a block of " + reader->fileName + "!";
+		slot.ready = true;
+		pthread_cond_broadcast(&reader->blockReady);
+	}
+	pthread_mutex_unlock(&reader->lock);
+
+	return NULL;
+}
+
+bool BgzfReader::loadBlock(Slot& slot) {
+	unsigned char *p = slot.comp;
+	size_t count;
+
+	count = fread(p, 1, HEADER_LENGTH, fi);
+	if (count == 0) return false;
+
+	// gzip magic, deflate, FEXTRA, XLEN = 6, subfield 'BC' of length 2 holding the block size - 1
+	if (count != (size_t)HEADER_LENGTH || p[0] != 31 || p[1] != 139 || p[2] != 8 || !(p[3] & 4) ||
+	    p[10] != 6 || p[11] != 0 || p[12] != 'B' || p[13] != 'C' || p[14] != 2 || p[15] != 0) {
+		error = fileName + " is not a valid BGZF file!";
+		return false;
+	}
+
+	slot.compLen = (p[16] | (p[17] << 8)) + 1;
+	if (slot.compLen < HEADER_LENGTH + 8 || fread(p + HEADER_LENGTH, 1, slot.compLen - HEADER_LENGTH, fi) != (size_t)(slot.compLen - HEADER_LENGTH)) {
+		error = fileName + " is truncated!";
+		return false;
+	}
+
+	return true;
+}
+
+bool BgzfReader::inflateBlock(z_stream& zs, Slot& slot) {
+	const unsigned char *footer = slot.comp + slot.compLen - 4;
+	int size = footer[0] | (footer[1] << 8) | (footer[2] << 16) | (footer[3] << 24); // uncompressed size, ISIZE
+
+	if (inflateReset(&zs) != Z_OK) return false;
+	zs.next_in = slot.comp + HEADER_LENGTH;
+	zs.avail_in = slot.compLen - HEADER_LENGTH - 8;
+	zs.next_out = slot.data;
+	zs.avail_out = MAX_BLOCK_SIZE;
+	if (inflate(&zs, Z_FINISH) != Z_STREAM_END) return false;
+
+	slot.dataLen = MAX_BLOCK_SIZE - zs.avail_out;
+
+	return slot.dataLen == size;
+}
+
+bool BgzfReader::nextBlock() {
+	pthread_mutex_lock(&lock);
+	if (started) {
+		slots[cur % nSlots].ready = false;
+		++cur;
+		pos = 0;
+		pthread_cond_broadcast(&slotFreed);
+	}
+	started = true;
+	while (!(cur < nextRead && slots[cur % nSlots].ready) && !(eof && cur >= nextRead) && error == "")
+		pthread_cond_wait(&blockReady, &lock);
+	general_assert(error == "", error);
+	bool success = cur < nextRead;
+	pthread_mutex_unlock(&lock);
+
+	return success;
+}
+
+int BgzfReader::read(void* data, int length) {
+	unsigned char *out = (unsigned char*)data;
+	int copied = 0, size;
+
+	while (copied < length) {
+		if (!started || pos >= slots[cur % nSlots].dataLen) {
+			if (!nextBlock()) break;
+			continue; // blocks may be empty, e.g. the end of file marker
+		}
+		Slot &slot = slots[cur % nSlots];
+		size = std::min(length - copied, slot.dataLen - pos);
+		memcpy(out + copied, slot.data + pos, size);
+		copied += size;
+		pos += size;
+	}
+
+	return copied;
+}
+
+int BgzfReader::readBam(bam1_t* b) {
+	bam1_core_t *c = &b->core;
+	int32_t block_len, ret;
+	uint32_t x[8];
+
+	if ((ret = read(&block_len, 4)) != 4) return (ret == 0 ? -1 : -2);
+	if (read(x, 32) != 32) return -3;
+
+	c->tid = x[0]; c->pos = x[1];
+	c->bin = x[2] >> 16; c->qual = x[2] >> 8 & 0xff; c->l_qname = x[2] & 0xff;
+	c->flag = x[3] >> 16; c->n_cigar = x[3] & 0xffff;
+	c->l_qseq = x[4];
+	c->mtid = x[5]; c->mpos = x[6]; c->isize = x[7];
+	b->data_len = block_len - 32;
+	if (b->m_data < b->data_len) {
+		b->m_data = b->data_len;
+		kroundup32(b->m_data);
+		b->data = (uint8_t*)realloc(b->data, b->m_data);
+	}
+	if (read(b->data, b->data_len) != b->data_len) return -4;
+	b->l_aux = b->data_len - c->n_cigar * 4 - c->l_qname - c->l_qseq - (c->l_qseq + 1) / 2;
+
+	return 4 + block_len;
+}
+
+#endif /* BGZFREADER_H_ */
@@ -0,0 +1,149 @@
+#ifndef CHAINSTATS_H_
+#define CHAINSTATS_H_
+
+/**
+Running statistics of the samples of one Markov chain, from which the effective sample size (ESS) and the
+split-chain R-hat of every vector entry are computed while the chains run.
+
+Samples are summed in batches: the sums and sums of squares of each batch are kept, and when MAX_BATCHES
+batches are full, neighbouring batches are merged and the batch size doubles. Memory stays at about
+2 * MAX_BATCHES vectors per chain however long the chain runs. Samples of the batch being filled are not
+used by the diagnostics.
+
+The ESS of a chain is estimated by batch means (n * sample variance / (batch size * variance of batch means)).
+The R-hat splits every chain into its first and second half (an even number of batches) and compares the
+variance between the half chains with the variance within them (Gelman et al., Bayesian Data Analysis).
+ */
+
+#include<cmath>
+#include<cassert>
+#include<vector>
+#include<algorithm>
+
+class ChainStats {
+public:
+	static const int MAX_BATCHES = 16;
+
+	ChainStats(int len);
+
+	void add(const std::vector<int>& sample);
+
+	int getNSamples() const { return nSamples; }
+
+	// whether every chain has enough full batches for the diagnostics
+	static bool isReady(const std::vector<ChainStats*>& chains);
+
+	// ess and rhat of entry i, and its mean over the samples used
+	static void calcDiagnostics(const std::vector<ChainStats*>& chains, int i, double& mean, double& ess, double& rhat);
+
+private:
+	int len, nSamples, batchSize, nFull, nCur;
+	std::vector<double> sums, sqs; // sums[b * len + i] : sum of entry i over the samples of full batch b
+	std::vector<double> curSum, curSq; // batch being filled
+
+	void merge();
+};
+
+ChainStats::ChainStats(int len) {
+	this->len = len;
+	nSamples = 0;
+	batchSize = 1;
+	nFull = nCur = 0;
+	sums.assign((size_t)MAX_BATCHES * len, 0.0);
+	sqs.assign((size_t)MAX_BATCHES * len, 0.0);
+	curSum.assign(len, 0.0);
+	curSq.assign(len, 0.0);
+}
+
+void ChainStats::add(const std::vector<int>& sample) {
+	assert((int)sample.size() == len);
+	for (int i = 0; i < len; i++) {
+		double value = sample[i];
+		curSum[i] += value;
+		curSq[i] += value * value;
+	}
+	++nSamples;
+
+	if (++nCur < batchSize) return;
+
+	if (nFull == MAX_BATCHES) merge();
+	for (int i = 0; i < len; i++) {
+		sums[(size_t)nFull * len + i] = curSum[i];
+		sqs[(size_t)nFull * len + i] = curSq[i];
+	}
+	++nFull;
+	curSum.assign(len, 0.0);
+	curSq.assign(len, 0.0);
+	nCur = 0;
+}
+
+// pairs of batches become one, so batches are twice as long from now on
+void ChainStats::merge() {
+	for (int b = 0; b < MAX_BATCHES / 2; b++)
+		for (int i = 0; i < len; i++) {
+			sums[(size_t)b * len + i] = sums[(size_t)(2 * b) * len + i] + sums[(size_t)(2 * b + 1) * len + i];
+			sqs[(size_t)b * len + i] = sqs[(size_t)(2 * b) * len + i] + sqs[(size_t)(2 * b + 1) * len + i];
+		}
+	nFull = MAX_BATCHES / 2;
+	batchSize *= 2;
+}
+
+bool ChainStats::isReady(const std::vector<ChainStats*>& chains) {
+	for (int c = 0; c < (int)chains.size(); c++)
+		if (chains[c]->nFull < 4) return false;
+	return !chains.empty();
+}
+
+void ChainStats::calcDiagnostics(const std::vector<ChainStats*>& chains, int i, double& mean, double& ess, double& rhat) {
+	int nHalves = 0;
+	double totN = 0.0, W = 0.0, meanOfMeans = 0.0, B = 0.0, halfLen = 0.0;
+	std::vector<double> halfMeans;
+
+	assert(isReady(chains));
+	mean = ess = 0.0;
+	for (int c = 0; c < (int)chains.size(); c++) {
+		const ChainStats &st = *chains[c];
+		int half = st.nFull / 2, nb = 2 * half;
+		double n = (double)half * st.batchSize, chainSum = 0.0, chainSq = 0.0, bmSq = 0.0;
+
+		for (int h = 0; h < 2; h++) {
+			double sum = 0.0, sq = 0.0;
+			for (int b = h * half; b < (h + 1) * half; b++) {
+				sum += st.sums[(size_t)b * st.len + i];
+				sq += st.sqs[(size_t)b * st.len + i];
+			}
+			double m = sum / n;
+			W += std::max(sq - n * m * m, 0.0) / (n - 1.0);
+			halfMeans.push_back(m);
+			meanOfMeans += m;
+			halfLen += n;
+			++nHalves;
+			chainSum += sum; chainSq += sq;
+		}
+
+		double chainN = 2.0 * n, chainMean = chainSum / chainN;
+		double chainVar = std::max(chainSq - chainN * chainMean * chainMean, 0.0) / (chainN - 1.0);
+		for (int b = 0; b < nb; b++) {
+			double bm = st.sums[(size_t)b * st.len + i] / st.batchSize - chainMean;
+			bmSq += bm * bm;
+		}
+		double bmVar = bmSq / (nb - 1);
+
+		// a chain which did not move has as many effective samples as samples
+		ess += (bmVar > 0.0 ? std::min(chainN, nb * chainVar / bmVar) : chainN);
+		mean += chainSum;
+		totN += chainN;
+	}
+
+	mean /= totN;
+	W /= nHalves;
+	meanOfMeans /= nHalves;
+	halfLen /= nHalves;
+	for (int h = 0; h < nHalves; h++) B += (halfMeans[h] - meanOfMeans) * (halfMeans[h] - meanOfMeans);
+	B /= nHalves - 1; // B / n in the usual notation
+
+	if (W > 0.0) rhat = sqrt(((halfLen - 1.0) / halfLen * W + B) / W);
+	else rhat = (B > 0.0 ? HUGE_VAL : 1.0);
+}
+
+#endif /* CHAINSTATS_H_ */
@@ -0,0 +1,124 @@
+#ifndef COMPONENTS_H_
+#define COMPONENTS_H_
+
+/**
+Connected components of the graph linking transcripts that share a read (class) in an EquivClasses store.
+The noise transcript 0 is left out, otherwise everything would be one component.
+
+Component c owns transcripts [tS[c], tS[c + 1]) of tids and classes [cS[c], cS[c + 1]) of cids.
+Components are numbered by decreasing number of class entries, so handing them out in order schedules
+the big ones first. Transcripts without any read belong to no component.
+ */
+
+#include<cassert>
+#include<vector>
+#include<algorithm>
+
+#include "EquivClasses.h"
+
+class Components {
+public:
+	Components() { clear(); }
+
+	void clear();
+
+	// M : number of transcripts
+	void build(const EquivClasses& ecs, int M);
+
+	int getNComp() const { return nComp; }
+
+	int getTSAt(int pos) const { assert(pos >= 0 && pos <= nComp); return tS[pos]; }
+	int getTidAt(int pos) const { return tids[pos]; }
+	int getCSAt(int pos) const { assert(pos >= 0 && pos <= nComp); return cS[pos]; }
+	int getCidAt(int pos) const { return cids[pos]; }
+	long long getSizeAt(int pos) const { assert(pos >= 0 && pos < nComp); return sizes[pos]; } // number of class entries
+
+private:
+	int nComp;
+	std::vector<int> tS, tids, cS, cids;
+	std::vector<long long> sizes;
+
+	std::vector<int> parent;
+
+	int find(int x) {
+		while (parent[x] != x) { parent[x] = parent[parent[x]]; x = parent[x]; }
+		return x;
+	}
+};
+
+void Components::clear() {
+	nComp = 0;
+	tS.assign(1, 0); tids.clear();
+	cS.assign(1, 0); cids.clear();
+	sizes.clear();
+	parent.clear();
+}
+
+void Components::build(const EquivClasses& ecs, int M) {
+	int nc = ecs.getNC();
+	std::vector<int> compOf, order, tCnt, cCnt;
+	std::vector<long long> size;
+	std::vector<std::pair<long long, int> > bySize;
+
+	clear();
+
+	parent.resize(M + 1);
+	for (int i = 0; i <= M; i++) parent[i] = i;
+
+	// entry 0 of each class is the noise transcript
+	for (int i = 0; i < nc; i++) {
+		int fr = ecs.getSAt(i) + 1, to = ecs.getSAt(i + 1);
+		for (int j = fr + 1; j < to; j++) {
+			int a = find(ecs.getSidAt(fr)), b = find(ecs.getSidAt(j));
+			if (a != b) parent[b] = a;
+		}
+	}
+
+	// number the roots having at least one class
+	compOf.assign(M + 1, -1);
+	for (int i = 0; i < nc; i++) {
+		if (ecs.getSAt(i + 1) - ecs.getSAt(i) < 2) continue; // noise only
+		int root = find(ecs.getSidAt(ecs.getSAt(i) + 1));
+		if (compOf[root] < 0) { compOf[root] = nComp++; size.push_back(0); }
+		size[compOf[root]] += ecs.getSAt(i + 1) - ecs.getSAt(i);
+	}
+
+	// renumber components by decreasing size
+	for (int i = 0; i < nComp; i++) bySize.push_back(std::make_pair(-size[i], i));
+	sort(bySize.begin(), bySize.end());
+	order.resize(nComp);
+	sizes.resize(nComp);
+	for (int i = 0; i < nComp; i++) { order[bySize[i].second] = i; sizes[i] = -bySize[i].first; }
+	for (int i = 1; i <= M; i++)
+		if (compOf[i] >= 0) compOf[i] = order[compOf[i]];
+
+	// fill in transcripts and classes, counting sort by component
+	tCnt.assign(nComp + 1, 0);
+	cCnt.assign(nComp + 1, 0);
+	for (int i = 1; i <= M; i++) {
+		int c = compOf[find(i)];
+		if (c >= 0) ++tCnt[c + 1];
+	}
+	for (int i = 0; i < nc; i++) {
+		if (ecs.getSAt(i + 1) - ecs.getSAt(i) < 2) continue;
+		++cCnt[compOf[find(ecs.getSidAt(ecs.getSAt(i) + 1))] + 1];
+	}
+	for (int i = 0; i < nComp; i++) { tCnt[i + 1] += tCnt[i]; cCnt[i + 1] += cCnt[i]; }
+	tS = tCnt; cS = cCnt;
+
+	tids.resize(tS[nComp]);
+	for (int i = 1; i <= M; i++) {
+		int c = compOf[find(i)];
+		if (c >= 0) tids[tCnt[c]++] = i;
+	}
+	cids.resize(cS[nComp]);
+	for (int i = 0; i < nc; i++) {
+		if (ecs.getSAt(i + 1) - ecs.getSAt(i) < 2) continue;
+		int c = compOf[find(ecs.getSidAt(ecs.getSAt(i) + 1))];
+		cids[cCnt[c]++] = i;
+	}
+
+	parent.clear();
+}
+
+#endif /* COMPONENTS_H_ */
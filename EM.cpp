@@ -8,6 +8,7 @@
 #include<vector>
 #include<algorithm>
 #include<pthread.h>
+#include<sys/stat.h>
 
 #include "utils.h"
 #include "my_assert.h"
@@ -34,35 +35,77 @@
 #include "Refs.h"
 #include "GroupInfo.h"
 #include "HitContainer.h"
+#include "HitFile.h"
 #include "ReadIndex.h"
 #include "ReadReader.h"
+#include "ReadStore.h"
 
 #include "ModelParams.h"
 
+#include "EquivClasses.h"
+#include "Components.h"
+
 #include "HitWrapper.h"
 #include "BamWriter.h"
 
+#include "WorkerPool.h"
+#include "PerfLog.h"
+#include "ProcessGroup.h"
+#include "OfgFile.h"
+
 using namespace std;
 
 const double STOP_CRITERIA = 0.001;
 const int MAX_ROUND = 10000;
 const int MIN_ROUND = 20;
 
+const int BLOCKS_PER_THREAD = 16; // read blocks handed out per thread and round, more blocks balance better
+const int MIN_BLOCK_COST = 4096; // but a block should cost at least this much (see init)
+const int GATHER_LEN = 65536; // doubles per slot of the process group, gatherConPrbs sends hits in rounds of this many
+
+const double WARM_START_MIX = 1e-6; // weight of the uniform vector mixed into a warm start theta, small enough to stay below what the stop criterion checks
+
+// per worker; reads come in blocks (see nextBlock), the reader, model helper and countv stay with the worker
 struct Params {
+	int id; // worker id
 	void *model;
-	void *reader, *hitv, *ncpv, *mhp, *countv;
+	void *reader, *hitvs, *ncpvs, *mhp, *countv;
+};
+
+struct ECParams {
+	EquivClasses *ecs;
+	int fr, to; // classes [fr, to)
+	double *countv;
+	double loglik;
 };
 
 int read_type;
 int m, M; // m genes, M isoforms
 int N0, N1, N2, N_tot;
 int nThreads;
+int nBlocks; // reads are split into nBlocks contiguous blocks, hitvs[b] and ncpvs[b] hold block b
+int nextBlock; // next block to be handed out in the current round
+int blockFr, blockTo; // blocks [blockFr, blockTo) are this process's (see ProcessGroup.h), all blocks with a single process
+int *blockStarts; // id of the first read of each block
+
+// results of E_STEP per block, added up in block order by addUpBlocks(), so that they do not depend on which worker ran a block
+vector<vector<int> > blockSids; // the sids of a block's hits and 0, sorted; blockCounts[b][k] is the expected count of blockSids[b][k]
+vector<vector<double> > blockCounts;
+vector<double> blockLogliks; // log-likelihood of a block's reads under probv, up to a constant
+int statsLen; // length of the packed model statistics (see packStats)
+vector<double> blockStats; // packed model statistics of each block of this process, only while the model is updated
 
 
 bool genBamF; // If user wants to generate bam file, true; otherwise, false.
 bool bamSampling; // true if sampling from read posterior distribution when bam file is generated
 bool updateModel, calcExpectedWeights;
 bool genGibbsOut; // generate file for Gibbs sampler
+bool useEqClasses; // run the rounds after the model is frozen on equivalence classes instead of reads
+double ecTolerance; // relative difference of normalized conditional probabilities up to which reads share a class, 0 : exact
+bool useSquarem; // accelerate the rounds after the model is frozen by SQUAREM extrapolation
+bool useComponents; // after the model is frozen, run EM on each connected component of transcripts separately
+bool useCompactHits; // after the model is frozen, run the E step on a compact copy of the hits (see EquivClasses.h)
+bool hitsReleased; // the pages of the hits were given back while ecs was in use (see HitFile::releaseHits)
 
 char refName[STRLEN], outName[STRLEN];
 char imdName[STRLEN], statName[STRLEN];
@@ -83,68 +126,191 @@ double *probv, **countvs;
 Refs refs;
 GroupInfo gi;
 Transcripts transcripts;
+EquivClasses ecs;
+Components comps;
+HitFile datFile; // hitvs point into this mapping
+OfgFile ofgFile; // Gibbs input, written by the threads in place
+vector<int> ofgReads, ofgEntries; // first read and first entry of each block in ofgFile
+
+int nReadFs; // number of read files, 2 for paired-end reads
+ReadIndex *indices[2]; // shared by all readers, which locate the start of each block through them
+
+int readStoreMB; // memory budget (in MB) for keeping alignable reads in memory, 0 means reading from files
+ReadStore readStore;
+
+int checkpointSecs; // seconds between checkpoints, negative means no checkpoints
+bool resumeEM; // resume from the checkpoint, if there is one
+char ckptF[STRLEN], ckptModelF[STRLEN];
+char warmStartName[STRLEN]; // prefix of a previous run's .theta and .model, empty means no warm start
+
+bool genPerfLog; // write the performance log (see PerfLog.h)
+
+int nProcs; // number of processes the reads are split over
+ProcessGroup *group; // adds up counts and model statistics of the processes, NULL with a single process
+long long alignableBytes; // total size of the alignable read files
 
 ModelParams mparams;
 
+// fileF = prefix followed by suffix, fails instead of cutting a name off which does not fit into STRLEN
+void makeFileName(char* fileF, const char* prefix, const char* suffix) {
+	general_assert(snprintf(fileF, STRLEN, "%s%s", prefix, suffix) < STRLEN, "File name " + cstrtos(prefix) + cstrtos(suffix) + " is too long!");
+}
+
+// size of a file in bytes, 0 if it cannot be found
+long long getFileSize(const char* fileF) {
+	struct stat st;
+	return (stat(fileF, &st) == 0 ? (long long)st.st_size : 0LL);
+}
+
+// total size of the read files of one type (0 unalignable, 1 alignable, 2 filtered)
+long long getReadFileBytes(int tagType) {
+	int s;
+	char readFs[2][STRLEN];
+	long long bytes = 0;
+
+	genReadFileNames(imdName, tagType, read_type, s, readFs);
+	for (int i = 0; i < s; i++) bytes += getFileSize(readFs[i]);
+
+	return bytes;
+}
+
+// load the alignable reads [fr, to) into readStore, returns false if they do not fit into readStoreMB
+template<class ReadType>
+bool loadReadStore(char readFs[][STRLEN], int fr, int to) {
+	ReadReader<ReadType> reader(nReadFs, readFs);
+	ReadType read;
+	long cnt = 0;
+
+	reader.setIndices(indices);
+	general_assert(fr == to || reader.locate(fr), "Read indices files do not match!");
+	readStore.init(nReadFs, read_type == 1 || read_type == 3, (long long)readStoreMB * 1024 * 1024);
+	while (cnt < to - fr && reader.next(read, 3)) {
+		if (!read.write(readStore)) {
+			if (verbose) { printf("Alignable reads do not fit into %d MB, they will be read from files.\n", readStoreMB); }
+			return false;
+		}
+		++cnt;
+	}
+	readStore.finish();
+	general_assert(cnt == to - fr, "Number of alignable reads does not match!");
+
+	if (verbose) { printf("%ld alignable reads are loaded into memory, using %.1f MB.\n", cnt, readStore.getSize() / 1024.0 / 1024.0); }
+
+	return true;
+}
+
+// estimated cost of read rid in E_STEP (see init), fileBytes : sizes of the read files, avgBytes : their bytes per read
+double getReadCost(int rid, const int* offsets, const long long* fileBytes, double avgBytes) {
+	double bytes = 0.0;
+	for (int i = 0; i < nReadFs; i++) bytes += indices[i]->getReadBytes(rid, fileBytes[i]);
+	return (1.0 + offsets[rid + 1] - offsets[rid]) * (1.0 + (avgBytes > 0.0 ? bytes / avgBytes : 1.0)) * 0.5;
+}
+
 template<class ReadType, class HitType, class ModelType>
 void init(ReadReader<ReadType> **&readers, HitContainer<HitType> **&hitvs, double **&ncpvs, ModelType **&mhps) {
-	int nReads, nHits, rt;
-	int nrLeft, nhT, curnr; // nrLeft : number of reads left, nhT : hit threshold per thread, curnr: current number of reads
+	int nHits;
+	double costT; // estimated cost per block
+	int *offsets;
+	HitType *allHits;
 	char datF[STRLEN];
 
-	int s;
 	char readFs[2][STRLEN];
-	ReadIndex *indices[2];
-	ifstream fin;
 
 	readers = new ReadReader<ReadType>*[nThreads];
-	genReadFileNames(imdName, 1, read_type, s, readFs);
-	for (int i = 0; i < s; i++) {
+	genReadFileNames(imdName, 1, read_type, nReadFs, readFs);
+	for (int i = 0; i < nReadFs; i++) {
 		indices[i] = new ReadIndex(readFs[i]);
 	}
 	for (int i = 0; i < nThreads; i++) {
-		readers[i] = new ReadReader<ReadType>(s, readFs, refs.hasPolyA(), mparams.seedLen); // allow calculation of calc_lq() function
+		readers[i] = new ReadReader<ReadType>(nReadFs, readFs, refs.hasPolyA(), mparams.seedLen); // allow calculation of calc_lq() function
 		readers[i]->setIndices(indices);
 	}
 
-	hitvs = new HitContainer<HitType>*[nThreads];
-	for (int i = 0; i < nThreads; i++) {
-		hitvs[i] = new HitContainer<HitType>();
-	}
+	alignableBytes = getReadFileBytes(1);
 
+	PerfScope datScope(".dat load");
 	sprintf(datF, "%s.dat", imdName);
-	fin.open(datF);
-	general_assert(fin.is_open(), "Cannot open " + cstrtos(datF) + "! It may not exist.");
-	fin>>nReads>>nHits>>rt;
-	general_assert(nReads == N1, "Number of alignable reads does not match!");
-	general_assert(rt == read_type, "Data file (.dat) does not have the right read type!");
-
-
-	//A just so so strategy for paralleling
-	nhT = nHits / nThreads;
-	nrLeft = N1;
-	curnr = 0;
-
-	ncpvs = new double*[nThreads];
-	for (int i = 0; i < nThreads; i++) {
-		int ntLeft = nThreads - i - 1; // # of threads left
-
-		general_assert(readers[i]->locate(curnr), "Read indices files do not match!");
-
-		while (nrLeft > ntLeft && (i == nThreads - 1 || hitvs[i]->getNHits() < nhT)) {
-			general_assert(hitvs[i]->read(fin), "Cannot read alignments from .dat file!");
-
-			--nrLeft;
-			if (verbose && nrLeft % 1000000 == 0) { printf("DAT %d reads left!\n", nrLeft); }
-		}
+	datFile.map(datF, sizeof(HitType));
+	general_assert(datFile.getN() == N1, "Number of alignable reads does not match!");
+	general_assert(datFile.getReadType() == read_type, "Data file (.dat) does not have the right read type!");
+	nHits = datFile.getNHits();
+	offsets = datFile.getOffsets();
+	allHits = (HitType*)datFile.getHits();
+
+	/*
+	  Blocks are balanced by an estimated cost of one per read (loading it and the noise probability) plus one
+	  per hit, weighted by (1 + the read's length relative to the average) / 2: rounds on a frozen model only
+	  weigh hits, but rounds which load reads compute every conditional probability base by base. Read lengths
+	  come from the byte positions in the read indices (.ridx), which are kept for every gap-th read, so a read
+	  counts with the average length of its run of reads.
+	  Every task takes blocks from a shared counter (see runBlocks), so a block which turns out to be slow only
+	  delays the worker holding it. E_STEP keeps the sums of each block apart and addUpBlocks() adds them up in
+	  block order, so results are reproducible bit for bit for a given number of threads and processes.
+	 */
+	long long fileBytes[2];
+	double avgBytes = (N1 > 0 ? (double)alignableBytes / N1 : 0.0), totCost = 0.0, cost;
+	for (int i = 0; i < nReadFs; i++) fileBytes[i] = getFileSize(readFs[i]);
+	for (int i = 0; i < N1; i++) totCost += getReadCost(i, offsets, fileBytes, avgBytes);
+	costT = max((double)MIN_BLOCK_COST, totCost / (nThreads * BLOCKS_PER_THREAD));
+
+	vector<int> starts(1, 0);
+	cost = 0.0;
+	for (int i = 0; i < N1; i++) {
+		if (cost >= costT) { starts.push_back(i); cost = 0.0; }
+		cost += getReadCost(i, offsets, fileBytes, avgBytes);
+	}
+	if (N1 > 0) starts.push_back(N1);
+	nBlocks = starts.size() - 1;
+
+	hitvs = new HitContainer<HitType>*[nBlocks];
+	ncpvs = new double*[nBlocks];
+	blockStarts = new int[nBlocks + 1];
+	for (int i = 0; i < nBlocks; i++) {
+		blockStarts[i] = starts[i];
+		hitvs[i] = new HitContainer<HitType>();
+		hitvs[i]->setView(offsets, allHits, starts[i], starts[i + 1]);
+	}
+	blockStarts[nBlocks] = N1;
+
+	/*
+	  Each process takes a contiguous range of blocks. The hits it writes conditional probabilities into are in
+	  pages of its own, and only its range gets noise probabilities and, with --read-store-memory, stored reads.
+	  The views of the other blocks cost nothing until their hits are read, which only process 0 does, to write
+	  the BAM output (see gatherConPrbs).
+	 */
+	int rank = (group != NULL ? group->getRank() : 0);
+	blockFr = (int)((long long)nBlocks * rank / nProcs);
+	blockTo = (int)((long long)nBlocks * (rank + 1) / nProcs);
+	blockSids.assign(nBlocks, vector<int>());
+	blockCounts.assign(nBlocks, vector<double>());
+	blockLogliks.assign(nBlocks, 0.0);
+	for (int i = 0; i < nBlocks; i++) {
+		ncpvs[i] = NULL;
+		if (i < blockFr || i >= blockTo) continue;
 		ncpvs[i] = new double[hitvs[i]->getN()];
 		memset(ncpvs[i], 0, sizeof(double) * hitvs[i]->getN());
-		curnr += hitvs[i]->getN();
 
-		if (verbose) { printf("Thread %d : N = %d, NHit = %d\n", i, hitvs[i]->getN(), hitvs[i]->getNHits()); }
+		vector<int> &sids = blockSids[i];
+		sids.assign(1, 0);
+		for (int j = 0; j < hitvs[i]->getNHits(); j++) sids.push_back(hitvs[i]->getHitAt(j).getSid());
+		sort(sids.begin(), sids.end());
+		sids.erase(unique(sids.begin(), sids.end()), sids.end());
+		vector<int>(sids).swap(sids);
+		blockCounts[i].assign(sids.size(), 0.0);
 	}
 
-	fin.close();
+	datScope.setCounts(N1, nHits, datFile.getFileSize());
+	datScope.stop();
+
+	if (readStoreMB > 0) {
+		int fr = blockStarts[blockFr], to = blockStarts[blockTo];
+		PerfScope scope("Read store load");
+		scope.setCounts(to - fr, 0, (long long)((double)alignableBytes * (to - fr) / N1));
+		if (loadReadStore<ReadType>(readFs, fr, to))
+			for (int i = 0; i < nThreads; i++) readers[i]->setStore(&readStore, fr);
+	}
+
+	if (verbose) { printf("%d reads, %d hits, split into %d blocks of estimated cost %.0f\n", N1, nHits, nBlocks, costT); }
 
 	mhps = new ModelType*[nThreads];
 	for (int i = 0; i < nThreads; i++) {
@@ -161,110 +327,476 @@ void init(ReadReader<ReadType> **&readers, HitContainer<HitType> **&hitvs, doubl
 	if (verbose) { printf("EM_init finished!\n"); }
 }
 
-template<class ReadType, class HitType, class ModelType>
+/*
+  The E step, specialized on the flags of the round: CalcConPrb (model->getNeedCalcConPrb()), UpdateModel (updateModel)
+  and CalcWeights (calcExpectedWeights). The flags only change between rounds, so getEStep() picks the instantiation
+  once per round and the loops below carry no tests of them. With all three false (rounds on a frozen model) no read
+  is loaded and the loop over hits does nothing but weigh, normalize and count.
+*/
+template<class ReadType, class HitType, class ModelType, bool CalcConPrb, bool UpdateModel, bool CalcWeights>
 void* E_STEP(void* arg) {
 	Params *params = (Params*)arg;
 	ModelType *model = (ModelType*)(params->model);
 	ReadReader<ReadType> *reader = (ReadReader<ReadType>*)(params->reader);
-	HitContainer<HitType> *hitv = (HitContainer<HitType>*)(params->hitv);
-	double *ncpv = (double*)(params->ncpv);
+	HitContainer<HitType> **hitvs = (HitContainer<HitType>**)(params->hitvs);
+	double **ncpvs = (double**)(params->ncpvs);
 	ModelType *mhp = (ModelType*)(params->mhp);
 	double *countv = (double*)(params->countv);
 
-	bool needCalcConPrb = model->getNeedCalcConPrb();
-
 	ReadType read;
 
-	int N = hitv->getN();
+	HitContainer<HitType> *hitv;
+	double *ncpv;
+	int N, b;
 	double sum;
 	vector<double> fracs; //to remove this, do calculation twice
 	int fr, to, id;
+	double loglik;
 
-	if (needCalcConPrb || updateModel) { reader->reset(); }
-	if (updateModel) { mhp->init(); }
+	if (UpdateModel) { mhp->init(); }
 
+	// countv holds the sums of the current block only, they are moved into blockCounts when it is done
 	memset(countv, 0, sizeof(double) * (M + 1));
-	for (int i = 0; i < N; i++) {
-		if (needCalcConPrb || updateModel) {
-			general_assert(reader->next(read), "Can not load a read!");
-		}
 
-		fr = hitv->getSAt(i);
-		to = hitv->getSAt(i + 1);
-		fracs.resize(to - fr + 1);
+	while ((b = __sync_fetch_and_add(&nextBlock, 1)) < blockTo) {
+		loglik = 0.0;
+		hitv = hitvs[b];
+		ncpv = ncpvs[b];
+		N = hitv->getN();
 
-		sum = 0.0;
+		if (CalcConPrb || UpdateModel) { general_assert(reader->locate(blockStarts[b]), "Read indices files do not match!"); }
 
-		if (needCalcConPrb) { ncpv[i] = model->getNoiseConPrb(read); }
-		fracs[0] = probv[0] * ncpv[i];
-		if (fracs[0] < EPSILON) fracs[0] = 0.0;
-		sum += fracs[0];
-		for (int j = fr; j < to; j++) {
-			HitType &hit = hitv->getHitAt(j);
-			if (needCalcConPrb) { hit.setConPrb(model->getConPrb(read, hit)); }
-			id = j - fr + 1;
-			fracs[id] = probv[hit.getSid()] * hit.getConPrb();
-			if (fracs[id] < EPSILON) fracs[id] = 0.0;
-			sum += fracs[id];
-		}
+		for (int i = 0; i < N; i++) {
+			if (CalcConPrb || UpdateModel) {
+				general_assert(reader->next(read), "Can not load a read!");
+			}
 
-		if (sum >= EPSILON) {
-			fracs[0] /= sum;
-			countv[0] += fracs[0];
-			if (updateModel) { mhp->updateNoise(read, fracs[0]); }
-			if (calcExpectedWeights) { ncpv[i] = fracs[0]; }
+			fr = hitv->getSAt(i);
+			to = hitv->getSAt(i + 1);
+			fracs.resize(to - fr + 1);
+
+			sum = 0.0;
+
+			if (CalcConPrb) { ncpv[i] = model->getNoiseConPrb(read); }
+			fracs[0] = probv[0] * ncpv[i];
+			if (fracs[0] < EPSILON) fracs[0] = 0.0;
+			sum += fracs[0];
 			for (int j = fr; j < to; j++) {
 				HitType &hit = hitv->getHitAt(j);
+				if (CalcConPrb) { hit.setConPrb(model->getConPrb(read, hit)); }
 				id = j - fr + 1;
-				fracs[id] /= sum;
-				countv[hit.getSid()] += fracs[id];
-				if (updateModel) { mhp->update(read, hit, fracs[id]); }
-				if (calcExpectedWeights) { hit.setConPrb(fracs[id]); }
-			}			
+				fracs[id] = probv[hit.getSid()] * hit.getConPrb();
+				if (fracs[id] < EPSILON) fracs[id] = 0.0;
+				sum += fracs[id];
+			}
+
+			if (sum >= EPSILON) {
+				loglik += log(sum);
+				fracs[0] /= sum;
+				countv[0] += fracs[0];
+				if (UpdateModel) { mhp->updateNoise(read, fracs[0]); }
+				if (CalcWeights) { ncpv[i] = fracs[0]; }
+				for (int j = fr; j < to; j++) {
+					HitType &hit = hitv->getHitAt(j);
+					id = j - fr + 1;
+					fracs[id] /= sum;
+					countv[hit.getSid()] += fracs[id];
+					if (UpdateModel) { mhp->update(read, hit, fracs[id]); }
+					if (CalcWeights) { hit.setConPrb(fracs[id]); }
+				}			
+			}
+			else if (CalcWeights) {
+				ncpv[i] = 0.0;
+				for (int j = fr; j < to; j++) {
+					HitType &hit = hitv->getHitAt(j);
+					hit.setConPrb(0.0);
+				}
+			}
 		}
-		else if (calcExpectedWeights) {
-			ncpv[i] = 0.0;
+
+		const vector<int> &sids = blockSids[b];
+		double *counts = &blockCounts[b][0];
+		for (int k = 0; k < (int)sids.size(); k++) { counts[k] = countv[sids[k]]; countv[sids[k]] = 0.0; }
+		blockLogliks[b] = loglik;
+		if (UpdateModel) {
+			mhp->packStats(&blockStats[(size_t)(b - blockFr) * statsLen]);
+			mhp->init();
+		}
+	}
+
+	return NULL;
+}
+
+// add up the counts E_STEP left per block into countvs[0], in block order; returns the log-likelihood of this process's reads
+double addUpBlocks() {
+	double loglik = 0.0;
+
+	memset(countvs[0], 0, sizeof(double) * (M + 1));
+	for (int b = blockFr; b < blockTo; b++) {
+		const vector<int> &sids = blockSids[b];
+		const vector<double> &counts = blockCounts[b];
+		for (int k = 0; k < (int)sids.size(); k++) countvs[0][sids[k]] += counts[k];
+		loglik += blockLogliks[b];
+	}
+
+	return loglik;
+}
+
+// the same for the model statistics, into model; mhp is a model helper, whose statistics have the layout of blockStats
+template<class ModelType>
+void addUpBlockStats(ModelType& model, ModelType& mhp) {
+	mhp.init();
+	for (int b = blockFr; b < blockTo; b++) mhp.collectStats(&blockStats[(size_t)(b - blockFr) * statsLen]);
+	model.init();
+	model.collect(mhp);
+}
+
+// the E step instantiation for the flags of the current round, see E_STEP
+template<class ReadType, class HitType, class ModelType>
+WorkerPool::TaskType getEStep(bool needCalcConPrb) {
+	static const WorkerPool::TaskType steps[8] = {
+		E_STEP<ReadType, HitType, ModelType, false, false, false>, E_STEP<ReadType, HitType, ModelType, false, false, true>,
+		E_STEP<ReadType, HitType, ModelType, false, true, false>, E_STEP<ReadType, HitType, ModelType, false, true, true>,
+		E_STEP<ReadType, HitType, ModelType, true, false, false>, E_STEP<ReadType, HitType, ModelType, true, false, true>,
+		E_STEP<ReadType, HitType, ModelType, true, true, false>, E_STEP<ReadType, HitType, ModelType, true, true, true>
+	};
+	return steps[(needCalcConPrb ? 4 : 0) + (updateModel ? 2 : 0) + (calcExpectedWeights ? 1 : 0)];
+}
+
+//report how long each worker was busy in the last round and how long it waited at the barrier
+void reportWorkerTimes(const WorkerPool& pool, const std::string& phase) {
+	if (!verbose) return;
+	printf("%s : wall time = %.3fs", phase.c_str(), pool.getRoundTime());
+	for (int i = 0; i < pool.getNThreads(); i++) {
+		printf(", thread %d = %.3fs (idle %.3fs)", i, pool.getWorkerTime(i), pool.getRoundTime() - pool.getWorkerTime(i));
+	}
+	printf("\n");
+}
+
+// record the last round of pool as phase in the performance log
+void logWorkerTimes(const WorkerPool& pool, const std::string& phase, long long reads = 0, long long hits = 0, long long bytes = 0) {
+	if (!perfLog.isOpen()) return;
+	vector<double> times(pool.getNThreads());
+	for (int i = 0; i < pool.getNThreads(); i++) times[i] = pool.getWorkerTime(i);
+	perfLog.record(phase, pool.getRoundTime(), reads, hits, bytes, pool.getNThreads(), &times[0]);
+}
+
+// E step over equivalence classes, only valid when the model is frozen
+void* EC_E_STEP(void* arg) {
+	ECParams *params = (ECParams*)arg;
+	EquivClasses *ecs = params->ecs;
+	double *countv = params->countv;
+
+	const int *sids = ecs->getSids();
+	const float *weights = ecs->getWeights();
+	const int *sp;
+	const float *wp;
+	double *fp;
+
+	double sum, mult, scale, value;
+	vector<double> fracs;
+	int len;
+
+	params->loglik = 0.0;
+	memset(countv, 0, sizeof(double) * (M + 1));
+	for (int i = params->fr; i < params->to; i++) {
+		len = ecs->getSAt(i + 1) - ecs->getSAt(i);
+		sp = sids + ecs->getSAt(i);
+		wp = weights + ecs->getSAt(i);
+		mult = ecs->getMultAt(i);
+		if ((int)fracs.size() < len) fracs.resize(len);
+		fp = &fracs[0];
+
+		// branch free, so that the compiler can vectorize everything but the gather from probv
+		sum = 0.0;
+		for (int j = 0; j < len; j++) {
+			value = probv[sp[j]] * wp[j];
+			fp[j] = (value < EPSILON ? 0.0 : value);
+			sum += fp[j];
+		}
+
+		// weights of a class sum up to mult, so sum / mult is the average read's likelihood
+		if (sum >= EPSILON) {
+			params->loglik += mult * log(sum / mult);
+			scale = mult / sum;
+			for (int j = 0; j < len; j++) {
+				countv[sp[j]] += fp[j] * scale;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+// frees the hit pages of each block as soon as the block is in ecs, so that the hits and ecs are never resident together
+template<class HitType>
+struct ReleaseBlockHits {
+	HitContainer<HitType> **hitvs;
+	long long released; // in bytes
+
+	ReleaseBlockHits(HitContainer<HitType> **hitvs) : hitvs(hitvs), released(0) {}
+
+	void operator() (int i) {
+		int n = hitvs[i]->getNHits();
+		if (n > 0) released += datFile.releaseHits(&hitvs[i]->getHitAt(0), &hitvs[i]->getHitAt(n - 1) + 1);
+	}
+};
+
+//split classes among threads so that each thread gets about the same number of entries
+void partitionEquivClasses(ECParams* ecparams) {
+	int nT = ecs.getNEntries() / nThreads;
+	int cur = 0;
+
+	for (int i = 0; i < nThreads; i++) {
+		int to = cur;
+		while (to < ecs.getNC() && (i == nThreads - 1 || ecs.getSAt(to) - ecs.getSAt(cur) < nT)) ++to;
+
+		ecparams[i].ecs = &ecs;
+		ecparams[i].fr = cur;
+		ecparams[i].to = to;
+		ecparams[i].countv = countvs[i];
+		cur = to;
+
+		if (verbose) { printf("Thread %d : NC = %d, NEntries = %d\n", i, to - ecparams[i].fr, ecs.getSAt(to) - ecs.getSAt(ecparams[i].fr)); }
+	}
+}
+
+// shared by the workers of componentEM
+int nextComp; // next component to be handed out
+int compMinRound; // minimum number of rounds per component in this pass
+double compTotal; // sum of expected counts, the M step denominator
+vector<double> compNoise; // expected number of noise reads in each component
+vector<int> compRounds, compTotNum; // rounds used and number of unconverged transcripts per component
+
+// EM on the transcripts of component c with theta[0] held fixed; components share no transcripts, so workers can update theta in place
+void runComponentEM(int c, vector<double>& fracs) {
+	int tfr = comps.getTSAt(c), tto = comps.getTSAt(c + 1);
+	int cfr = comps.getCSAt(c), cto = comps.getCSAt(c + 1);
+	int round, totNum, cid, fr, to, sid;
+	double sum, mult, noise, value, change;
+
+	round = 0;
+	do {
+		++round;
+
+		for (int i = tfr; i < tto; i++) probv[comps.getTidAt(i)] = 0.0; // probv is used for expected counts here
+
+		noise = 0.0;
+		for (int i = cfr; i < cto; i++) {
+			cid = comps.getCidAt(i);
+			fr = ecs.getSAt(cid);
+			to = ecs.getSAt(cid + 1);
+			mult = ecs.getMultAt(cid);
+			fracs.resize(to - fr);
+
+			sum = 0.0;
 			for (int j = fr; j < to; j++) {
-				HitType &hit = hitv->getHitAt(j);
-				hit.setConPrb(0.0);
+				fracs[j - fr] = theta[ecs.getSidAt(j)] * (ecs.getWeightAt(j) / mult);
+				if (fracs[j - fr] < EPSILON) fracs[j - fr] = 0.0;
+				sum += fracs[j - fr];
 			}
+
+			if (sum >= EPSILON) {
+				noise += mult * fracs[0] / sum; // entry 0 is always the noise transcript
+				for (int j = fr + 1; j < to; j++) {
+					probv[ecs.getSidAt(j)] += mult * fracs[j - fr] / sum;
+				}
+			}
+		}
+
+		totNum = 0;
+		for (int i = tfr; i < tto; i++) {
+			sid = comps.getTidAt(i);
+			value = probv[sid] / compTotal;
+			if (theta[sid] >= 1e-7) {
+				change = fabs(value - theta[sid]) / theta[sid];
+				if (change >= STOP_CRITERIA) ++totNum;
+			}
+			theta[sid] = value;
 		}
+	} while (round < compMinRound || (totNum > 0 && round < MAX_ROUND));
+
+	compNoise[c] = noise;
+	compRounds[c] = round;
+	compTotNum[c] = totNum;
+}
+
+void* COMP_EM(void* arg) {
+	vector<double> fracs;
+	int c;
+
+	// components are sorted by decreasing size, so the big ones are started first
+	while ((c = __sync_fetch_and_add(&nextComp, 1)) < comps.getNComp()) {
+		runComponentEM(c, fracs);
 	}
 
 	return NULL;
 }
 
+/*
+Runs the rest of EM component by component once the model is frozen. Each pass iterates every component
+to convergence with theta[0] fixed, then updates theta[0] from the expected noise counts; passes repeat
+until theta[0] converges too. The fixed point is the same as the one of the full EM.
+total : sum of expected counts in the last full round
+minRound : minimum number of rounds per component in the first pass
+Returns the number of components (plus one for the noise transcript) not meeting the convergence criteria.
+ */
+int componentEM(WorkerPool* pool, double total, int minRound) {
+	void *cargs[nThreads];
+	int nComp = comps.getNComp(), pass, totNum, maxRounds;
+	double value, change, sum;
+	long long work, fullWork; // class entries visited, by components and by full rounds doing the same number of passes
+
+	for (int i = 0; i < nThreads; i++) cargs[i] = NULL;
+
+	// transcripts without reads get no expected counts
+	vector<bool> inComp(M + 1, false);
+	for (int i = 0; i < comps.getTSAt(nComp); i++) inComp[comps.getTidAt(i)] = true;
+	for (int i = 1; i <= M; i++)
+		if (!inComp[i]) theta[i] = 0.0;
+
+	compTotal = total;
+	compNoise.assign(nComp, 0.0);
+	compRounds.assign(nComp, 0);
+	compTotNum.assign(nComp, 0);
+
+	work = fullWork = 0;
+	pass = 0;
+	do {
+		++pass;
+		nextComp = 0;
+		compMinRound = (pass == 1 ? max(minRound, 1) : 1);
+		pool->run(COMP_EM, cargs);
+		reportWorkerTimes(*pool, "Component EM, pass " + itos(pass));
+		perfLog.setRound(pass);
+		logWorkerTimes(*pool, "Component EM");
+
+		value = N0;
+		for (int i = 0; i < nComp; i++) value += compNoise[i];
+		value /= total;
+		change = (theta[0] >= 1e-7 ? fabs(value - theta[0]) / theta[0] : 0.0);
+		theta[0] = value;
+
+		totNum = (change >= STOP_CRITERIA);
+		maxRounds = 0;
+		for (int i = 0; i < nComp; i++) {
+			if (compTotNum[i] > 0) ++totNum;
+			if (maxRounds < compRounds[i]) maxRounds = compRounds[i];
+			work += comps.getSizeAt(i) * compRounds[i];
+		}
+		for (int i = 0; i < nComp; i++) fullWork += comps.getSizeAt(i) * maxRounds;
+
+		if (verbose) printf("Component EM pass %d : max rounds = %d, noise change = %f, totNum = %d\n", pass, maxRounds, change, totNum);
+	} while (change >= STOP_CRITERIA && pass < MAX_ROUND);
+
+	sum = 0.0;
+	for (int i = 0; i <= M; i++) sum += theta[i];
+	assert(sum >= EPSILON);
+	for (int i = 0; i <= M; i++) theta[i] /= sum;
+
+	if (verbose) printf("Component EM finished after %d passes, %lld class entries visited (%lld if all components were iterated for as long as the slowest)\n", pass, work, fullWork);
+
+	return totNum;
+}
+
 template<class ReadType, class HitType, class ModelType>
 void* calcConProbs(void* arg) {
 	Params *params = (Params*)arg;
 	ModelType *model = (ModelType*)(params->model);
 	ReadReader<ReadType> *reader = (ReadReader<ReadType>*)(params->reader);
-	HitContainer<HitType> *hitv = (HitContainer<HitType>*)(params->hitv);
-	double *ncpv = (double*)(params->ncpv);
+	HitContainer<HitType> **hitvs = (HitContainer<HitType>**)(params->hitvs);
+	double **ncpvs = (double**)(params->ncpvs);
 
 	ReadType read;
-	int N = hitv->getN();
+	HitContainer<HitType> *hitv;
+	double *ncpv;
+	int N, b;
 	int fr, to;
 
 	assert(model->getNeedCalcConPrb());
-	reader->reset();
 
-	for (int i = 0; i < N; i++) {
-		general_assert(reader->next(read), "Can not load a read!");
+	while ((b = __sync_fetch_and_add(&nextBlock, 1)) < blockTo) {
+		hitv = hitvs[b];
+		ncpv = ncpvs[b];
+		N = hitv->getN();
+
+		general_assert(reader->locate(blockStarts[b]), "Read indices files do not match!");
+
+		for (int i = 0; i < N; i++) {
+			general_assert(reader->next(read), "Can not load a read!");
+
+			fr = hitv->getSAt(i);
+			to = hitv->getSAt(i + 1);
 
-		fr = hitv->getSAt(i);
-		to = hitv->getSAt(i + 1);
+			ncpv[i] = model->getNoiseConPrb(read);
+			for (int j = fr; j < to; j++) {
+				HitType &hit = hitv->getHitAt(j);
+				hit.setConPrb(model->getConPrb(read, hit));
+			}
+		}
+	}
 
-		ncpv[i] = model->getNoiseConPrb(read);
-		for (int j = fr; j < to; j++) {
-			HitType &hit = hitv->getHitAt(j);
-			hit.setConPrb(model->getConPrb(read, hit));
+	return NULL;
+}
+
+// count the reads and entries each block contributes to the Gibbs input, into ofgReads[b + 1] and ofgEntries[b + 1]
+template<class HitType>
+void* countOfg(void* arg) {
+	Params *params = (Params*)arg;
+	HitContainer<HitType> **hitvs = (HitContainer<HitType>**)(params->hitvs);
+	double **ncpvs = (double**)(params->ncpvs);
+	int b, N, nReads, nEntries, totNum;
+
+	while ((b = __sync_fetch_and_add(&nextBlock, 1)) < blockTo) {
+		N = hitvs[b]->getN();
+		nReads = nEntries = 0;
+		for (int i = 0; i < N; i++) {
+			totNum = (ncpvs[b][i] >= EPSILON);
+			for (int j = hitvs[b]->getSAt(i); j < hitvs[b]->getSAt(i + 1); j++)
+				if (hitvs[b]->getHitAt(j).getConPrb() >= EPSILON) ++totNum;
+			if (totNum > 0) { ++nReads; nEntries += totNum; }
 		}
+		ofgReads[b + 1] = nReads;
+		ofgEntries[b + 1] = nEntries;
 	}
 
 	return NULL;
 }
 
+// write each block's reads into ofgFile, at the positions countOfg worked out
+template<class HitType>
+void* writeOfg(void* arg) {
+	Params *params = (Params*)arg;
+	HitContainer<HitType> **hitvs = (HitContainer<HitType>**)(params->hitvs);
+	double **ncpvs = (double**)(params->ncpvs);
+	int *offsets = ofgFile.getOffsets(), *sids = ofgFile.getSids();
+	double *conprbs = ofgFile.getConPrbs();
+	int b, N, r, e;
+
+	while ((b = __sync_fetch_and_add(&nextBlock, 1)) < blockTo) {
+		N = hitvs[b]->getN();
+		r = ofgReads[b]; e = ofgEntries[b];
+		for (int i = 0; i < N; i++) {
+			int fr = e;
+			if (ncpvs[b][i] >= EPSILON) { sids[e] = 0; conprbs[e] = ncpvs[b][i]; ++e; }
+			for (int j = hitvs[b]->getSAt(i); j < hitvs[b]->getSAt(i + 1); j++) {
+				HitType &hit = hitvs[b]->getHitAt(j);
+				if (hit.getConPrb() >= EPSILON) { sids[e] = hit.getSid(); conprbs[e] = hit.getConPrb(); ++e; }
+			}
+			if (e > fr) offsets[r++] = fr;
+		}
+		assert(r == ofgReads[b + 1] && e == ofgEntries[b + 1]);
+	}
+
+	return NULL;
+}
+
+// run a task over the read blocks of this process on the pool, the workers take the blocks from nextBlock
+void runBlocks(WorkerPool* pool, WorkerPool::TaskType task, void** args) {
+	nextBlock = blockFr;
+	pool->run(task, args);
+}
+
 template<class ModelType>
 void calcExpectedEffectiveLengths(ModelType& model) {
   int lb, ub, span;
@@ -382,14 +914,137 @@ void release(ReadReader<ReadType> **readers, HitContainer<HitType> **hitvs, doub
 
 	for (int i = 0; i < nThreads; i++) {
 		delete readers[i];
+		delete mhps[i];
+	}
+	for (int i = 0; i < nBlocks; i++) {
 		delete hitvs[i];
 		delete[] ncpvs[i];
-		delete mhps[i];
 	}
+	delete[] blockStarts;
+	blockSids.clear(); blockCounts.clear(); blockLogliks.clear();
+	vector<double>().swap(blockStats);
+	for (int i = 0; i < nReadFs; i++) delete indices[i];
+	readStore.clear();
 	delete[] readers;
 	delete[] hitvs;
 	delete[] ncpvs;
 	delete[] mhps;
+
+	datFile.unmap();
+}
+
+// add up the counts of all threads (and processes) into countvs[0]
+void reduceCounts() {
+	for (int i = 1; i < nThreads; i++) {
+		for (int j = 0; j <= M; j++) {
+			countvs[0][j] += countvs[i][j];
+		}
+	}
+	if (group != NULL) group->allreduce(countvs[0], M + 1);
+}
+
+// copy the conditional probabilities of the other processes' hits into process 0, a slot at a time
+template<class HitType>
+void gatherConPrbs() {
+	int *offsets = datFile.getOffsets();
+	HitType *hits = (HitType*)datFile.getHits();
+	int nHits = datFile.getNHits(), maxLen = group->getMaxLen();
+	int ownFr = offsets[blockStarts[blockFr]], ownTo = offsets[blockStarts[blockTo]];
+	bool isMaster = (group->getRank() == 0);
+	vector<double> buf(maxLen);
+
+	for (int fr = 0; fr < nHits; fr += maxLen) {
+		int len = min(maxLen, nHits - fr);
+		for (int i = 0; i < len; i++) buf[i] = (fr + i >= ownFr && fr + i < ownTo ? hits[fr + i].getConPrb() : 0.0);
+		group->reduce(&buf[0], len);
+		if (!isMaster) continue;
+		for (int i = 0; i < len; i++)
+			if (fr + i < ownFr || fr + i >= ownTo) hits[fr + i].setConPrb(buf[i]);
+	}
+}
+
+/*
+One EM update with the model frozen: theta1 = F(theta0).
+Returns the log-likelihood of theta0 (up to a constant), which the E step gets for free.
+ */
+template<class ReadType, class HitType, class ModelType>
+double updateTheta(WorkerPool* pool, Params* fparams, void** fargs, ECParams* ecparams, void** ecargs, const vector<double>& theta0, vector<double>& theta1) {
+	double loglik, sum;
+
+	for (int i = 0; i <= M; i++) probv[i] = theta0[i];
+
+	loglik = 0.0;
+	if (ecs.getNC() > 0) {
+		pool->run(EC_E_STEP, ecargs);
+		for (int i = 0; i < nThreads; i++) loglik += ecparams[i].loglik;
+	}
+	else {
+		runBlocks(pool, getEStep<ReadType, HitType, ModelType>(((ModelType*)fparams[0].model)->getNeedCalcConPrb()), fargs);
+		loglik = addUpBlocks();
+	}
+	if (group != NULL) group->allreduce(&loglik, 1);
+	if (N0 > 0) loglik += N0 * log(theta0[0]);
+
+	reduceCounts();
+	countvs[0][0] += N0;
+
+	sum = 0.0;
+	for (int i = 0; i <= M; i++) sum += countvs[0][i];
+	assert(sum >= EPSILON);
+	theta1.resize(M + 1);
+	for (int i = 0; i <= M; i++) theta1[i] = countvs[0][i] / sum;
+
+	return loglik;
+}
+
+/*
+One SQUAREM cycle (Varadhan & Roland 2008, scheme S3) starting from theta, which is replaced by the result.
+theta1 = F(theta), theta2 = F(theta1), r = theta1 - theta, v = theta2 - theta1 - r,
+alpha = -|r| / |v| (at most -1), theta' = theta - 2 * alpha * r + alpha^2 * v, result = F(theta').
+Entries of theta' below 0 are replaced by the corresponding entries of theta2. If theta' has a smaller
+log-likelihood than theta, the extrapolation is rejected and the plain EM result theta2 is kept instead.
+On return, probv holds the point the last EM update started from, so the caller's relative change test is
+the change made by one EM update, as without acceleration. Returns the number of EM updates made.
+ */
+template<class ReadType, class HitType, class ModelType>
+int squaremStep(WorkerPool* pool, Params* fparams, void** fargs, ECParams* ecparams, void** ecargs, bool& rejected) {
+	vector<double> theta1, theta2, thetaP, res;
+	double rr, vv, alpha, sum, ll0, llP;
+
+	ll0 = updateTheta<ReadType, HitType, ModelType>(pool, fparams, fargs, ecparams, ecargs, theta, theta1);
+	updateTheta<ReadType, HitType, ModelType>(pool, fparams, fargs, ecparams, ecargs, theta1, theta2);
+
+	rr = vv = 0.0;
+	for (int i = 0; i <= M; i++) {
+		double r = theta1[i] - theta[i], v = theta2[i] - 2.0 * theta1[i] + theta[i];
+		rr += r * r; vv += v * v;
+	}
+
+	rejected = false;
+	if (vv >= EPSILON) {
+		alpha = -sqrt(rr / vv);
+		if (alpha > -1.0) alpha = -1.0;
+
+		thetaP.resize(M + 1);
+		sum = 0.0;
+		for (int i = 0; i <= M; i++) {
+			double r = theta1[i] - theta[i], v = theta2[i] - 2.0 * theta1[i] + theta[i];
+			thetaP[i] = theta[i] - 2.0 * alpha * r + alpha * alpha * v;
+			if (thetaP[i] < 0.0) thetaP[i] = theta2[i];
+			sum += thetaP[i];
+		}
+		for (int i = 0; i <= M; i++) thetaP[i] /= sum;
+
+		llP = updateTheta<ReadType, HitType, ModelType>(pool, fparams, fargs, ecparams, ecargs, thetaP, res);
+		if (llP >= ll0) { theta = res; return 3; }
+		rejected = true;
+	}
+
+	// fall back to two plain EM updates
+	for (int i = 0; i <= M; i++) probv[i] = theta1[i];
+	theta = theta2;
+
+	return (rejected ? 3 : 2);
 }
 
 inline bool doesUpdateModel(int ROUND) {
@@ -397,12 +1052,97 @@ inline bool doesUpdateModel(int ROUND) {
   return ROUND <= 10;
 }
 
+// read a theta vector as written to .theta files: M + 1, then M + 1 values
+void readTheta(FILE *fi, const char* inpF) {
+	int val;
+
+	general_assert(fscanf(fi, "%d", &val) == 1 && val == M + 1, cstrtos(inpF) + " does not match the reference, " + itos(M + 1) + " values are expected!");
+	for (int i = 0; i <= M; i++)
+		general_assert(fscanf(fi, "%lf", &theta[i]) == 1, "Fail to read theta from " + cstrtos(inpF) + "!");
+}
+
+/*
+  A checkpoint is the model (ckptModelF) and ckptF, which holds the last finished ROUND, the number of alignable
+  reads and of hits it was taken on, followed by theta.
+  Checkpoints are only taken once the model is frozen, so the model files written over and over are identical
+  and a resumed run only needs to recompute the conditional probabilities. Files are written under temporary
+  names and renamed, so a job killed while writing leaves the previous checkpoint intact.
+ */
+template<class ModelType>
+void writeCheckpoint(ModelType& model, int ROUND) {
+	char tmpF[STRLEN];
+	FILE *fo;
+
+	makeFileName(tmpF, ckptModelF, ".tmp");
+	model.write(tmpF);
+	general_assert(rename(tmpF, ckptModelF) == 0, "Cannot write checkpoint " + cstrtos(ckptModelF) + "!");
+
+	makeFileName(tmpF, ckptF, ".tmp");
+	fo = fopen(tmpF, "w");
+	general_assert(fo != NULL, "Cannot create " + cstrtos(tmpF) + "!");
+	fprintf(fo, "%d %d %d\n%d\n", ROUND, N1, datFile.getNHits(), M + 1);
+	for (int i = 0; i < M; i++) fprintf(fo, "%.17g ", theta[i]);
+	fprintf(fo, "%.17g\n", theta[M]);
+	general_assert(fclose(fo) == 0, "Cannot write checkpoint " + cstrtos(tmpF) + "!");
+	general_assert(rename(tmpF, ckptF) == 0, "Cannot write checkpoint " + cstrtos(ckptF) + "!");
+}
+
+// returns the ROUND to continue after, or 0 if there is no checkpoint; a checkpoint of other data is refused
+template<class ModelType>
+int readCheckpoint(ModelType& model) {
+	int ROUND, ckptN1, ckptNHits;
+	char datF[STRLEN];
+	FILE *fi = fopen(ckptF, "r");
+
+	if (fi == NULL) return 0;
+	general_assert(fscanf(fi, "%d %d %d", &ROUND, &ckptN1, &ckptNHits) == 3 && ROUND > 0, cstrtos(ckptF) + " is not a valid checkpoint!");
+	makeFileName(datF, imdName, ".dat");
+	general_assert(ckptN1 == N1 && ckptNHits == HitFile::readHeader(datF).nHits, cstrtos(ckptF) + " was taken on other alignments (" + itos(ckptN1) + " reads, " + itos(ckptNHits) + " hits) than " + cstrtos(datF) + "! Remove it or run without --resume.");
+	readTheta(fi, ckptF);
+	fclose(fi);
+
+	model.read(ckptModelF);
+
+	return ROUND;
+}
+
+// seed theta and the model from a previous run; the model is used as it is, so the run starts as if the model had just been frozen
+template<class ModelType>
+int readWarmStart(ModelType& model) {
+	char inpF[STRLEN];
+	FILE *fi;
+	double sum;
+
+	makeFileName(inpF, warmStartName, ".theta");
+	fi = fopen(inpF, "r");
+	general_assert(fi != NULL, "Cannot open " + cstrtos(inpF) + "! It may not exist.");
+	readTheta(fi, inpF); // the first vector is theta', the one EM works on
+	fclose(fi);
+
+	// keep every transcript a little bit alive, EM cannot bring back one whose theta is exactly 0
+	sum = 0.0;
+	for (int i = 0; i <= M; i++) { theta[i] = (1.0 - WARM_START_MIX) * theta[i] + WARM_START_MIX / (M + 1); sum += theta[i]; }
+	general_assert(sum >= EPSILON, "Theta in " + cstrtos(inpF) + " sums to 0!");
+	for (int i = 0; i <= M; i++) theta[i] /= sum;
+
+	makeFileName(inpF, warmStartName, ".model");
+	model.read(inpF);
+
+	int ROUND = 0;
+	while (doesUpdateModel(ROUND + 1)) ++ROUND;
+
+	return ROUND;
+}
+
 //Including initialize, algorithm and results saving
 template<class ReadType, class HitType, class ModelType>
 void EM() {
 	FILE *fo;
 
 	int ROUND;
+	time_t lastCkpt; // time the last checkpoint was written
+	int nUpdates, nRejected; // number of EM updates of theta and of rejected SQUAREM extrapolations
+	bool rejected;
 	double sum;
 
 	double bChange = 0.0, change = 0.0; // bChange : biggest change
@@ -415,10 +1155,10 @@ void EM() {
 	ModelType **mhps; //model helpers
 
 	Params fparams[nThreads];
-	pthread_t threads[nThreads];
-	pthread_attr_t attr;
-	void *status;
-	int rc;
+	void *fargs[nThreads];
+	ECParams ecparams[nThreads];
+	void *ecargs[nThreads];
+	WorkerPool *pool;
 
 
 	//initialize boolean variables
@@ -426,70 +1166,162 @@ void EM() {
 
 	theta.clear();
 	theta.resize(M + 1, 0.0);
-	init<ReadType, HitType, ModelType>(readers, hitvs, ncpvs, mhps);
 
 	//set initial parameters
-	assert(N_tot > N2);
-	theta[0] = max(N0 * 1.0 / (N_tot - N2), 1e-8);
-	double val = (1.0 - theta[0]) / M;
-	for (int i = 1; i <= M; i++) theta[i] = val;
+	ROUND = 0;
+	if (resumeEM) {
+		ROUND = readCheckpoint<ModelType>(model);
+		if (verbose) {
+			if (ROUND > 0) printf("Resume EM from the checkpoint taken after ROUND %d\n", ROUND);
+			else printf("No checkpoint is found, EM starts from the beginning\n");
+		}
+	}
+	if (ROUND == 0 && warmStartName[0] != 0) {
+		ROUND = readWarmStart<ModelType>(model);
+		if (verbose) printf("Warm start from %s.theta and %s.model\n", warmStartName, warmStartName);
+	}
+	if (ROUND == 0) {
+		assert(N_tot > N2);
+		theta[0] = max(N0 * 1.0 / (N_tot - N2), 1e-8);
+		double val = (1.0 - theta[0]) / M;
+		for (int i = 1; i <= M; i++) theta[i] = val;
+
+		PerfScope scope("estimateFromReads");
+		scope.setCounts(N_tot, 0, getReadFileBytes(0) + getReadFileBytes(1) + (N2 > 0 ? getReadFileBytes(2) : 0));
+		model.estimateFromReads(imdName);
+	}
+	// a loaded model is frozen, but the conditional probabilities still have to be computed
+	model.setNeedCalcConPrb(true);
+	lastCkpt = time(NULL);
+
+	// the processes share the starting point, from here on each opens its files and runs its threads
+	group = NULL;
+	if (nProcs > 1) {
+		group = new ProcessGroup(nProcs, max(max(M + 1, model.packStats(NULL)), GATHER_LEN));
+		if (group->start() > 0) { verbose = false; perfLog.detach(); }
+	}
 
-	model.estimateFromReads(imdName);
+	init<ReadType, HitType, ModelType>(readers, hitvs, ncpvs, mhps);
+	statsLen = mhps[0]->packStats(NULL);
 
 	for (int i = 0; i < nThreads; i++) {
+		fparams[i].id = i;
 		fparams[i].model = (void*)(&model);
 
 		fparams[i].reader = (void*)readers[i];
-		fparams[i].hitv = (void*)hitvs[i];
-		fparams[i].ncpv = (void*)ncpvs[i];
+		fparams[i].hitvs = (void*)hitvs;
+		fparams[i].ncpvs = (void*)ncpvs;
 		fparams[i].mhp = (void*)mhps[i];
 		fparams[i].countv = (void*)countvs[i];
+
+		fargs[i] = (void*)(&fparams[i]);
+		ecargs[i] = (void*)(&ecparams[i]);
 	}
 
-	/* set thread attribute to be joinable */
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+	ecs.clear();
+	hitsReleased = false;
 
-	ROUND = 0;
+	// threads live for the whole EM, each round only hands them new work
+	pool = new WorkerPool(nThreads);
+	model.setWorkerPool(pool); // calcMW in model.finish() is spread over the threads as well
+
+	nUpdates = nRejected = 0;
+	sum = 0.0;
 	do {
 		++ROUND;
+		perfLog.setRound(ROUND);
 
 		updateModel = doesUpdateModel(ROUND);
+		// model statistics are kept per block while the model is updated only
+		if (updateModel) blockStats.resize((size_t)(blockTo - blockFr) * statsLen);
+		else vector<double>().swap(blockStats);
 
 		for (int i = 0; i <= M; i++) probv[i] = theta[i];
 
-		//E step
-		for (int i = 0; i < nThreads; i++) {
-			rc = pthread_create(&threads[i], &attr, E_STEP<ReadType, HitType, ModelType>, (void*)(&fparams[i]));
-			pthread_assert(rc, "pthread_create", "Cannot create thread " + itos(i) + " (numbered from 0) at ROUND " + itos(ROUND) + "!");
+		// once the model is frozen, conditional probabilities stay the same and reads can be collapsed
+		if ((useEqClasses || useComponents || useCompactHits) && ecs.getNC() == 0 && !updateModel && !model.getNeedCalcConPrb()) {
+			PerfScope scope(useEqClasses ? "Equivalence classes" : "Compact hits");
+			scope.setCounts(N1, datFile.getNHits(), 0);
+			// hits are not touched again until ecs is cleared, their pages are given back; conditional probabilities are recomputed after EM
+			ReleaseBlockHits<HitType> release(hitvs + blockFr);
+			ecs.setTolerance(ecTolerance);
+			ecs.build(blockTo - blockFr, hitvs + blockFr, ncpvs + blockFr, useEqClasses, release);
+			release.released += datFile.releaseHits(); // pages shared by two blocks
+			hitsReleased = true;
+			partitionEquivClasses(ecparams);
+			scope.stop();
+			if (verbose && useEqClasses) { printf("Collapsed %d reads into %d equivalence classes (%d entries) at ROUND %d\n", ecs.getNReads(), ecs.getNC(), ecs.getNEntries(), ROUND); }
+			if (verbose) { printf("Frozen E step uses %.1f MB, %.1f MB of hit pages released, resident set %.1f MB (peak so far %.1f MB)\n", ecs.getMemory() / 1048576.0, release.released / 1048576.0, PerfLog::getResidentMB(), PerfLog::getPeakResidentMB()); }
 		}
 
-		for (int i = 0; i < nThreads; i++) {
-			rc = pthread_join(threads[i], &status);
-			pthread_assert(rc, "pthread_join", "Cannot join thread " + itos(i) + " (numbered from 0) at ROUND " + itos(ROUND) + "!");
+		if (useComponents && !updateModel && !model.getNeedCalcConPrb()) {
+			PerfScope scope("Components");
+			scope.setCounts(ecs.getNC(), ecs.getNEntries(), 0);
+			comps.build(ecs, M);
+			scope.stop();
+			if (verbose) { printf("%d connected components, the largest has %d transcripts and %lld class entries\n", comps.getNComp(), (comps.getNComp() > 0 ? comps.getTSAt(1) : 0), (comps.getNComp() > 0 ? comps.getSizeAt(0) : 0LL)); }
+			// components take over the remaining rounds, doing at least MIN_ROUND rounds in total
+			totNum = componentEM(pool, sum, MIN_ROUND - ROUND + 1);
+			comps.clear();
+			break;
 		}
 
-		model.setNeedCalcConPrb(false);
-
-		for (int i = 1; i < nThreads; i++) {
-			for (int j = 0; j <= M; j++) {
-				countvs[0][j] += countvs[i][j];
-			}
+		if (useSquarem && !updateModel && !model.getNeedCalcConPrb()) {
+			PerfScope scope("SQUAREM step");
+			int nSteps = squaremStep<ReadType, HitType, ModelType>(pool, fparams, fargs, ecparams, ecargs, rejected);
+			nUpdates += nSteps;
+			if (rejected) ++nRejected;
+			// each step is a pass over the reads (classes), counts of the step are the sum over its passes
+			scope.setCounts((long long)nSteps * (ecs.getNC() > 0 ? ecs.getNC() : N1), (long long)nSteps * (ecs.getNC() > 0 ? ecs.getNEntries() : datFile.getNHits()), 0);
+			scope.stop();
+			reportWorkerTimes(*pool, "SQUAREM step, ROUND " + itos(ROUND));
 		}
+		else {
+			++nUpdates;
 
-		//add N0 noise reads
-		countvs[0][0] += N0;
+			//E step
+			if (ecs.getNC() > 0) {
+				pool->run(EC_E_STEP, ecargs);
+				logWorkerTimes(*pool, "E step", ecs.getNC(), ecs.getNEntries(), 0);
+			}
+			else {
+				runBlocks(pool, getEStep<ReadType, HitType, ModelType>(model.getNeedCalcConPrb()), fargs);
+				addUpBlocks();
+				// reads are only loaded when they are needed, and then from files unless they are in memory
+				logWorkerTimes(*pool, "E step", N1, datFile.getNHits(), ((updateModel || model.getNeedCalcConPrb()) && readStore.isEmpty() ? alignableBytes : 0));
+			}
+			reportWorkerTimes(*pool, "E step, ROUND " + itos(ROUND));
+
+			model.setNeedCalcConPrb(false);
+
+			PerfScope reduceScope("Reduction");
+			reduceCounts();
+
+			//add N0 noise reads
+			countvs[0][0] += N0;
+			reduceScope.stop();
+
+			//M step;
+			PerfScope mScope("M step");
+			sum = 0.0;
+			for (int i = 0; i <= M; i++) sum += countvs[0][i];
+			assert(sum >= EPSILON);
+			for (int i = 0; i <= M; i++) theta[i] = countvs[0][i] / sum;
+
+			if (updateModel) {
+				addUpBlockStats(model, *mhps[0]);
+				if (group != NULL) {
+					vector<double> stats(model.packStats(NULL));
+					model.packStats(&stats[0]);
+					group->allreduce(&stats[0], stats.size());
+					model.init();
+					model.collectStats(&stats[0]);
+				}
+				mScope.stop();
 
-		//M step;
-		sum = 0.0;
-		for (int i = 0; i <= M; i++) sum += countvs[0][i];
-		assert(sum >= EPSILON);
-		for (int i = 0; i <= M; i++) theta[i] = countvs[0][i] / sum;
-
-		if (updateModel) {
-			model.init();
-			for (int i = 0; i < nThreads; i++) { model.collect(*mhps[i]); }
-			model.finish();
+				PerfScope finishScope("model.finish"); // includes calcMW, which is also recorded on its own
+				model.finish();
+			}
 		}
 
 		// Relative error
@@ -502,58 +1334,69 @@ void EM() {
 			}
 
 		if (verbose) printf("ROUND = %d, SUM = %.15g, bChange = %f, totNum = %d\n", ROUND, sum, bChange, totNum);
+
+		if (checkpointSecs >= 0 && (group == NULL || group->getRank() == 0) && !doesUpdateModel(ROUND + 1) && time(NULL) - lastCkpt >= checkpointSecs) {
+			writeCheckpoint<ModelType>(model, ROUND);
+			lastCkpt = time(NULL);
+		}
 	} while (ROUND < MIN_ROUND || (totNum > 0 && ROUND < MAX_ROUND));
 	  //while (ROUND < MAX_ROUND);
 
-	if (totNum > 0) fprintf(stderr, "Warning: RSEM reaches %d iterations before meeting the convergence criteria.\n", MAX_ROUND);
+	if (verbose) {
+		printf("EM finished after %d rounds, %d updates of theta", ROUND, nUpdates);
+		if (useSquarem) printf(", %d SQUAREM extrapolations rejected", nRejected);
+		printf("\n");
+	}
+
+	// the processes stay together for the passes below, each on its own blocks; only process 0 writes results
+	bool isMaster = (group == NULL || group->getRank() == 0);
+
+	if (totNum > 0 && isMaster) fprintf(stderr, "Warning: RSEM reaches %d iterations before meeting the convergence criteria.\n", MAX_ROUND);
+
+	// EM is done, a later run must not resume from its checkpoint
+	if (isMaster) { remove(ckptF); remove(ckptModelF); }
+
+	ecs.clear(); // the remaining passes need per read results
+	if (hitsReleased) model.setNeedCalcConPrb(true); // the hits lost their conditional probabilities
+	perfLog.setRound(0);
 
 	//generate output file used by Gibbs sampler
 	if (genGibbsOut) {
 		if (model.getNeedCalcConPrb()) {
-			for (int i = 0; i < nThreads; i++) {
-				rc = pthread_create(&threads[i], &attr, calcConProbs<ReadType, HitType, ModelType>, (void*)(&fparams[i]));
-				pthread_assert(rc, "pthread_create", "Cannot create thread " + itos(i) + " (numbered from 0) when generating files for Gibbs sampler!");
-			}
-			for (int i = 0; i < nThreads; i++) {
-				rc = pthread_join(threads[i], &status);
-				pthread_assert(rc, "pthread_join", "Cannot join thread " + itos(i) + " (numbered from 0) when generating files for Gibbs sampler!");
-			}
+			runBlocks(pool, calcConProbs<ReadType, HitType, ModelType>, fargs);
+			reportWorkerTimes(*pool, "Calculating conditional probabilities");
+			logWorkerTimes(*pool, "Conditional probabilities", N1, datFile.getNHits(), (readStore.isEmpty() ? alignableBytes : 0));
 		}
 		model.setNeedCalcConPrb(false);
 
+		// two passes over the blocks: count what each block writes, then write every block at its place
+		PerfScope scope(".ofg write");
 		sprintf(out_for_gibbs_F, "%s.ofg", imdName);
-		fo = fopen(out_for_gibbs_F, "w");
-		fprintf(fo, "%d %d\n", M, N0);
-		for (int i = 0; i < nThreads; i++) {
-			int numN = hitvs[i]->getN();
-			for (int j = 0; j < numN; j++) {
-				int fr = hitvs[i]->getSAt(j);
-				int to = hitvs[i]->getSAt(j + 1);
-				int totNum = 0;
-
-				if (ncpvs[i][j] >= EPSILON) { ++totNum; fprintf(fo, "%d %.15g ", 0, ncpvs[i][j]); }
-				for (int k = fr; k < to; k++) {
-					HitType &hit = hitvs[i]->getHitAt(k);
-					if (hit.getConPrb() >= EPSILON) {
-						++totNum;
-						fprintf(fo, "%d %.15g ", hit.getSid(), hit.getConPrb());
-					}
-				}
-
-				if (totNum > 0) { fprintf(fo, "\n"); }
-			}
+		ofgReads.assign(nBlocks + 1, 0);
+		ofgEntries.assign(nBlocks + 1, 0);
+		runBlocks(pool, countOfg<HitType>, fargs);
+		if (group != NULL) {
+			// every block is counted by one process only
+			vector<double> counts(2 * (nBlocks + 1));
+			for (int i = 0; i <= nBlocks; i++) { counts[i] = ofgReads[i]; counts[nBlocks + 1 + i] = ofgEntries[i]; }
+			group->allreduce(&counts[0], counts.size());
+			for (int i = 0; i <= nBlocks; i++) { ofgReads[i] = (int)counts[i]; ofgEntries[i] = (int)counts[nBlocks + 1 + i]; }
 		}
-		fclose(fo);
+		for (int i = 0; i < nBlocks; i++) {
+			ofgReads[i + 1] += ofgReads[i];
+			ofgEntries[i + 1] += ofgEntries[i];
+		}
+		// process 0 creates the file, then every process fills in its blocks
+		if (isMaster) ofgFile.create(out_for_gibbs_F, M, N0, ofgReads[nBlocks], ofgEntries[nBlocks]);
+		if (group != NULL) group->barrier();
+		if (!isMaster) ofgFile.map(out_for_gibbs_F, true);
+		runBlocks(pool, writeOfg<HitType>, fargs);
+		scope.setCounts(N1, datFile.getNHits(), ofgFile.getFileSize());
+		ofgFile.unmap();
 	}
 
-	sprintf(thetaF, "%s.theta", statName);
-	fo = fopen(thetaF, "w");
-	fprintf(fo, "%d\n", M + 1);
+	vector<double> thetaP(theta); // theta'
 
-	// output theta'
-	for (int i = 0; i < M; i++) fprintf(fo, "%.15g ", theta[i]);
-	fprintf(fo, "%.15g\n", theta[M]);
-	
 	//calculate expected effective lengths for each isoform
 	calcExpectedEffectiveLengths<ModelType>(model);
 
@@ -570,24 +1413,56 @@ void EM() {
 	//calculate expected weights and counts using learned parameters
 	updateModel = false; calcExpectedWeights = true;
 	for (int i = 0; i <= M; i++) probv[i] = theta[i];
-	for (int i = 0; i < nThreads; i++) {
-		rc = pthread_create(&threads[i], &attr, E_STEP<ReadType, HitType, ModelType>, (void*)(&fparams[i]));
-		pthread_assert(rc, "pthread_create", "Cannot create thread " + itos(i) + " (numbered from 0) when calculating expected weights!");
-	}
-	for (int i = 0; i < nThreads; i++) {
-		rc = pthread_join(threads[i], &status);
-		pthread_assert(rc, "pthread_join", "Cannot join thread " + itos(i) + " (numbered from 0) when calculating expected weights!");
-	}
+	runBlocks(pool, getEStep<ReadType, HitType, ModelType>(model.getNeedCalcConPrb()), fargs);
+	addUpBlocks();
+	reportWorkerTimes(*pool, "Calculating expected weights");
+	logWorkerTimes(*pool, "Expected weights", N1, datFile.getNHits(), 0);
 	model.setNeedCalcConPrb(false);
-	for (int i = 1; i < nThreads; i++) {
-		for (int j = 0; j <= M; j++) {
-			countvs[0][j] += countvs[i][j];
+	reduceCounts();
+	countvs[0][0] += N0;
+
+	model.setWorkerPool(NULL);
+	delete pool;
+
+	if (genBamF && bamSampling) {
+		int local_N;
+		int fr, to, len, id;
+		vector<double> arr;
+		uniform01 rg(engine_type(time(NULL) + (group != NULL ? group->getRank() : 0)));
+
+		if (verbose && isMaster) printf("Begin to sample reads from their posteriors.\n");
+		for (int i = blockFr; i < blockTo; i++) {
+			local_N = hitvs[i]->getN();
+			for (int j = 0; j < local_N; j++) {
+				fr = hitvs[i]->getSAt(j);
+				to = hitvs[i]->getSAt(j + 1);
+				len = to - fr + 1;
+				arr.assign(len, 0);
+				arr[0] = ncpvs[i][j];
+				for (int k = fr; k < to; k++) arr[k - fr + 1] = arr[k - fr] + hitvs[i]->getHitAt(k).getConPrb();
+				id = (arr[len - 1] < EPSILON ? -1 : sample(rg, arr, len)); // if all entries in arr are 0, let id be -1
+				for (int k = fr; k < to; k++) hitvs[i]->getHitAt(k).setConPrb(k - fr + 1 == id ? 1.0 : 0.0);
+			}
 		}
+
+		if (verbose && isMaster) printf("Sampling is finished.\n");
 	}
-	countvs[0][0] += N0;
 
-	/* destroy attribute */
-	pthread_attr_destroy(&attr);
+	if (group != NULL) {
+		// the BAM output needs the weights of every hit in process 0
+		if (genBamF) gatherConPrbs<HitType>();
+		group->finish(); // the other processes exit here
+		delete group;
+		group = NULL;
+	}
+
+	sprintf(thetaF, "%s.theta", statName);
+	fo = fopen(thetaF, "w");
+	fprintf(fo, "%d\n", M + 1);
+
+	// output theta'
+	for (int i = 0; i < M; i++) fprintf(fo, "%.15g ", thetaP[i]);
+	fprintf(fo, "%.15g\n", thetaP[M]);
 
 	//convert theta' to theta
 	double *mw = model.getMW();
@@ -609,34 +1484,14 @@ void EM() {
 
 	if (genBamF) {
 		sprintf(outBamF, "%s.transcript.bam", outName);
-		
-		if (bamSampling) {
-			int local_N;
-			int fr, to, len, id;
-			vector<double> arr;
-			uniform01 rg(engine_type(time(NULL)));
-
-			if (verbose) printf("Begin to sample reads from their posteriors.\n");
-			for (int i = 0; i < nThreads; i++) {
-				local_N = hitvs[i]->getN();
-				for (int j = 0; j < local_N; j++) {
-					fr = hitvs[i]->getSAt(j);
-					to = hitvs[i]->getSAt(j + 1);
-					len = to - fr + 1;
-					arr.assign(len, 0);
-					arr[0] = ncpvs[i][j];
-					for (int k = fr; k < to; k++) arr[k - fr + 1] = arr[k - fr] + hitvs[i]->getHitAt(k).getConPrb();
-					id = (arr[len - 1] < EPSILON ? -1 : sample(rg, arr, len)); // if all entries in arr are 0, let id be -1
-					for (int k = fr; k < to; k++) hitvs[i]->getHitAt(k).setConPrb(k - fr + 1 == id ? 1.0 : 0.0);
-				}
-			}
 
-			if (verbose) printf("Sampling is finished.\n");
+		PerfScope scope("BAM write");
+		{
+			BamWriter writer(inpSamType, inpSamF, pt_fn_list, outBamF, transcripts);
+			HitWrapper<HitType> wrapper(nBlocks, hitvs);
+			writer.work(wrapper);
 		}
-
-		BamWriter writer(inpSamType, inpSamF, pt_fn_list, outBamF, transcripts);
-		HitWrapper<HitType> wrapper(nThreads, hitvs);
-		writer.work(wrapper);
+		scope.setCounts(N1, datFile.getNHits(), getFileSize(inpSamF) + getFileSize(outBamF));
 	}
 
 	release<ReadType, HitType, ModelType>(readers, hitvs, ncpvs, mhps);
@@ -647,7 +1502,7 @@ int main(int argc, char* argv[]) {
 	bool quiet = false;
 
 	if (argc < 5) {
-		printf("Usage : rsem-run-em refName read_type sampleName sampleToken [-p #Threads] [-b samInpType samInpF has_fn_list_? [fn_list]] [-q] [--gibbs-out] [--sampling]\n\n");
+		printf("Usage : rsem-run-em refName read_type sampleName sampleToken [-p #Threads] [-b samInpType samInpF has_fn_list_? [fn_list]] [-q] [--gibbs-out] [--sampling] [--eq-classes] [--eq-class-tolerance relDiff] [--squarem] [--components] [--compact-hits] [--read-store-memory MB] [--checkpoint seconds] [--resume] [--warm-start prefix] [--perf-log] [--processes #Processes]\n\n");
 		printf("  refName: reference name\n");
 		printf("  read_type: 0 single read without quality score; 1 single read with quality score; 2 paired-end read without quality score; 3 paired-end read with quality score.\n");
 		printf("  sampleName: sample's name, including the path\n");
@@ -657,23 +1512,48 @@ int main(int argc, char* argv[]) {
 		printf("  -q: set it quiet\n");
 		printf("  --gibbs-out: generate output file used by Gibbs sampler. (default: off)\n");
 		printf("  --sampling: sample each read from its posterior distribution when bam file is generated. (default: off)\n");
+		printf("  --eq-classes: after the model is frozen, run the remaining rounds on equivalence classes of reads sharing the same candidate transcripts and the same normalized conditional probabilities. (default: off)\n");
+		printf("  --eq-class-tolerance: let reads whose normalized conditional probabilities differ by up to about this relative amount share an equivalence class. Fewer classes make the rounds faster, but results are then only exact up to this amount. (default: 0, equal probabilities only)\n");
+		printf("  --squarem: after the model is frozen, accelerate EM by SQUAREM extrapolation, falling back to plain EM updates whenever the likelihood would drop. (default: off)\n");
+		printf("  --components: after the model is frozen, run EM on each connected component of transcripts separately, so that components stop as soon as they converge. --squarem does not apply to these rounds. (default: off)\n");
+		printf("  --compact-hits: after the model is frozen, run the E step on a compact copy of the hits holding only transcript ids and single precision normalized conditional probabilities. The pages of the hits are given back to the system meanwhile, and their conditional probabilities are recomputed after EM. (default: off)\n");
+		printf("  --read-store-memory: keep alignable reads in memory, packed, if they fit into this many MB, instead of reading them from files in every pass that needs them. With --processes, each process stores its own reads within this limit. (default: 0, off)\n");
+		printf("  --checkpoint: once the model is frozen, save theta, the model and the round number to imdName.ckpt and imdName.ckpt.model whenever at least this many seconds passed since the last save. Rounds run by --components are not checkpointed. (default: off)\n");
+		printf("  --resume: continue EM from the checkpoint left by an interrupted run, if there is one. (default: off)\n");
+		printf("  --perf-log: write the time and work counters of each phase to sampleName.perf.tsv, one tab separated line per phase and round (see PerfLog.h). (default: off)\n");
+		printf("  --warm-start: start from theta' and the model of a previous run, read from <prefix>.theta and <prefix>.model; the model is not learned again. (default: off)\n");
+		printf("  --processes: split the reads over this many processes, each running -p threads, which add up their counts and model statistics in shared memory every round. Cannot be used with --components. (default: 1)\n");
 		printf("// model parameters should be in imdName.mparams.\n");
 		exit(-1);
 	}
 
 	time_t a = time(NULL);
+	double startTime = PerfLog::getTime();
 
 	strcpy(refName, argv[1]);
 	read_type = atoi(argv[2]);
 	strcpy(outName, argv[3]);
 	sprintf(imdName, "%s.temp/%s", argv[3], argv[4]);
 	sprintf(statName, "%s.stat/%s", argv[3], argv[4]);
+	makeFileName(ckptF, imdName, ".ckpt");
+	makeFileName(ckptModelF, imdName, ".ckpt.model");
 
 	nThreads = 1;
+	nProcs = 1;
 
 	genBamF = false;
 	bamSampling = false;
 	genGibbsOut = false;
+	useEqClasses = false;
+	ecTolerance = 0.0;
+	useSquarem = false;
+	useComponents = false;
+	useCompactHits = false;
+	readStoreMB = 0;
+	checkpointSecs = -1;
+	resumeEM = false;
+	warmStartName[0] = 0;
+	genPerfLog = false;
 	pt_fn_list = pt_chr_list = NULL;
 
 	for (int i = 5; i < argc; i++) {
@@ -690,12 +1570,32 @@ int main(int argc, char* argv[]) {
 		if (!strcmp(argv[i], "-q")) { quiet = true; }
 		if (!strcmp(argv[i], "--gibbs-out")) { genGibbsOut = true; }
 		if (!strcmp(argv[i], "--sampling")) { bamSampling = true; }
+		if (!strcmp(argv[i], "--eq-classes")) { useEqClasses = true; }
+		if (!strcmp(argv[i], "--eq-class-tolerance")) { ecTolerance = atof(argv[i + 1]); }
+		if (!strcmp(argv[i], "--squarem")) { useSquarem = true; }
+		if (!strcmp(argv[i], "--components")) { useComponents = true; }
+		if (!strcmp(argv[i], "--compact-hits")) { useCompactHits = true; }
+		if (!strcmp(argv[i], "--read-store-memory")) { readStoreMB = atoi(argv[i + 1]); }
+		if (!strcmp(argv[i], "--checkpoint")) { checkpointSecs = atoi(argv[i + 1]); }
+		if (!strcmp(argv[i], "--resume")) { resumeEM = true; }
+		if (!strcmp(argv[i], "--warm-start")) { strcpy(warmStartName, argv[i + 1]); }
+		if (!strcmp(argv[i], "--perf-log")) { genPerfLog = true; }
+		if (!strcmp(argv[i], "--processes")) { nProcs = atoi(argv[i + 1]); }
 	}
 
 	general_assert(nThreads > 0, "Number of threads should be bigger than 0!");
+	general_assert(nProcs > 0, "Number of processes should be bigger than 0!");
+	general_assert(ecTolerance >= 0.0, "--eq-class-tolerance cannot be negative!");
+	general_assert(nProcs == 1 || !useComponents, "--processes cannot be used with --components!");
 
 	verbose = !quiet;
 
+	if (genPerfLog) {
+		char perfF[STRLEN];
+		sprintf(perfF, "%s.perf.tsv", outName);
+		perfLog.open(perfF);
+	}
+
 	//basic info loading
 	sprintf(refF, "%s.seq", refName);
 	refs.loadRefs(refF);
@@ -748,6 +1648,9 @@ int main(int argc, char* argv[]) {
 
 	time_t b = time(NULL);
 
+	perfLog.record("Total", PerfLog::getTime() - startTime);
+	perfLog.close();
+
 	printTimeUsed(a, b);
 
 	return 0;
@@ -0,0 +1,227 @@
+#ifndef EMISSION_H_
+#define EMISSION_H_
+
+/**
+Kernels for the probability of a read's bases under a base-emission table (Profile, QProfile, NoiseProfile,
+NoiseQProfile). The probability is a product with one table entry per base, indexed by a row (the position in
+the read, or the quality score), the reference base and the read base:
+  table[row * rowStride + refCode * refStride + readCode]
+
+Each kernel is specialized on whether there is a quality string and on how the reference is read, so the loop
+over the bases has no branches. Characters become codes through tables, with a single check per read instead of
+one per base; only if that check fails are the bases looked at again, to report the bad character the way
+get_base_id does. For the reverse strand the reference is walked backwards through a complement table, so a
+RefSeq needs no second copy of its sequence.
+
+There are two versions of the product, chosen at start-up:
+  - AVX2: 8 bases at a time; codes come from a byte shuffle on the low 4 bits of each character (A, C, G, T and N
+    differ there, in either case), indices are formed in 32-bit lanes and the entries are gathered 4 at a time.
+  - otherwise: 4 partial products, so that multiplications do not wait on each other.
+Both multiply in a different order than a plain left-to-right product, so results may differ in the last bits.
+ */
+
+#include<cstdio>
+#include<cstdlib>
+#include<cassert>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EMISSION_X86
+#include<immintrin.h>
+#endif
+
+#include "utils.h"
+
+const int EMISSION_NCODES = 5; // A, C, G, T, N
+const unsigned int EMISSION_BAD = 0x80; // the code of a character which is not a base; & 7 keeps indices inside the table
+
+// refDir of the kernels
+const int EMISSION_NOREF = -1; // the table has no reference term
+const int EMISSION_FWD = 0; // the reference is read forwards from ref
+const int EMISSION_REV = 1; // the reference is read backwards from ref, complemented
+
+struct EmissionCodes {
+	unsigned char fwd[256], rev[256]; // code of a base, code of its complement; EMISSION_BAD if not a base
+
+	EmissionCodes() {
+		for (int i = 0; i < 256; i++) fwd[i] = rev[i] = EMISSION_BAD;
+		const char *bases = "ACGTN", *lower = "acgtn";
+		for (int i = 0; i < EMISSION_NCODES; i++) {
+			fwd[(unsigned char)bases[i]] = fwd[(unsigned char)lower[i]] = i;
+			rev[(unsigned char)bases[i]] = rev[(unsigned char)lower[i]] = (i < 4 ? 3 - i : 4);
+		}
+	}
+};
+
+static const EmissionCodes emissionCodes;
+
+/*
+  index of read base i
+  row : the position in the read if hasQual is false, its quality score (Phred+33) otherwise
+  ref : the reference base aligned to read base 0, unused if refDir is EMISSION_NOREF
+  bad : EMISSION_BAD is or'ed in if a character is not a base or a quality score is out of range
+*/
+template<bool hasQual, int refDir>
+inline unsigned int emissionIndex(const char* read, const char* qual, const char* ref, int rowStride, int refStride, int i, unsigned int& bad) {
+	unsigned int c = emissionCodes.fwd[(unsigned char)read[i]], r = 0, row = i;
+
+	if (refDir == EMISSION_FWD) r = emissionCodes.fwd[(unsigned char)ref[i]];
+	if (refDir == EMISSION_REV) r = emissionCodes.rev[(unsigned char)ref[-i]];
+	if (hasQual) {
+		row = (unsigned int)((unsigned char)qual[i] - 33);
+		if (row > 93) { bad |= EMISSION_BAD; row = 0; }
+	}
+	bad |= c | r;
+
+	// a bad character is reported only after the product, so its index must not leave the table
+	return row * rowStride + (r & 7) * refStride + (c & 7);
+}
+
+// product over the read bases fr .. to - 1
+template<bool hasQual, int refDir>
+double emissionProbScalar(const double* table, const char* read, const char* qual, const char* ref, int rowStride, int refStride, int fr, int to, unsigned int& bad) {
+	double p0 = 1.0, p1 = 1.0, p2 = 1.0, p3 = 1.0;
+	int i = fr;
+
+	for (; i + 4 <= to; i += 4) {
+		p0 *= table[emissionIndex<hasQual, refDir>(read, qual, ref, rowStride, refStride, i, bad)];
+		p1 *= table[emissionIndex<hasQual, refDir>(read, qual, ref, rowStride, refStride, i + 1, bad)];
+		p2 *= table[emissionIndex<hasQual, refDir>(read, qual, ref, rowStride, refStride, i + 2, bad)];
+		p3 *= table[emissionIndex<hasQual, refDir>(read, qual, ref, rowStride, refStride, i + 3, bad)];
+	}
+	for (; i < to; i++) p0 *= table[emissionIndex<hasQual, refDir>(read, qual, ref, rowStride, refStride, i, bad)];
+
+	return (p0 * p1) * (p2 * p3);
+}
+
+#ifdef EMISSION_X86
+// codes of the 8 characters in the low half of ch; the low half of bad becomes nonzero where one is not a base
+__attribute__((target("avx2")))
+inline __m128i emissionCodes8(__m128i ch, __m128i codeTab, __m128i& bad) {
+	const __m128i charTab = _mm_setr_epi8(-1, 'A', -1, 'C', 'T', -1, -1, 'G', -1, -1, -1, -1, -1, -1, 'N', -1);
+	__m128i low = _mm_and_si128(ch, _mm_set1_epi8(0x0F));
+	__m128i ok = _mm_cmpeq_epi8(_mm_and_si128(ch, _mm_set1_epi8((char)0xDF)), _mm_shuffle_epi8(charTab, low)); // 0xDF : to upper case
+
+	bad = _mm_or_si128(bad, _mm_andnot_si128(ok, _mm_set1_epi8(-1)));
+	return _mm_shuffle_epi8(codeTab, low);
+}
+
+// product over the read bases 0 .. len - 1, len a multiple of 8; the tail is left to the caller, as calling the
+// scalar code from here would run it with the upper halves of the registers in use, which is slow on many CPUs
+template<bool hasQual, int refDir>
+__attribute__((target("avx2")))
+double emissionProbAVX2(const double* table, const char* read, const char* qual, const char* ref, int rowStride, int refStride, int len, unsigned int& bad) {
+	// code of the base whose character has these low 4 bits
+	const __m128i fwdTab = _mm_setr_epi8(0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 4, 0);
+	const __m128i revTab = _mm_setr_epi8(0, 3, 0, 2, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 4, 0);
+	const __m128i reverse8 = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i vbad = _mm_setzero_si128();
+	__m256i vRowStride = _mm256_set1_epi32(rowStride), vRefStride = _mm256_set1_epi32(refStride);
+	__m256i pos = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), step = _mm256_set1_epi32(8);
+	// the masked gathers, as the plain ones start from an undefined register gcc warns about
+	__m256d acc0 = _mm256_set1_pd(1.0), acc1 = acc0, zero = _mm256_setzero_pd(), all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+	double lanes[4], prob;
+	int i = 0;
+
+	assert(len % 8 == 0);
+	for (; i < len; i += 8) {
+		__m256i idx = _mm256_cvtepu8_epi32(emissionCodes8(_mm_loadl_epi64((const __m128i*)(read + i)), fwdTab, vbad));
+		if (refDir != EMISSION_NOREF) {
+			__m128i ch = (refDir == EMISSION_FWD ? _mm_loadl_epi64((const __m128i*)(ref + i)) : _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)(ref - i - 7)), reverse8));
+			__m256i r = _mm256_cvtepu8_epi32(emissionCodes8(ch, refDir == EMISSION_FWD ? fwdTab : revTab, vbad));
+			idx = _mm256_add_epi32(idx, _mm256_mullo_epi32(r, vRefStride));
+		}
+		__m256i row = pos;
+		if (hasQual) {
+			__m128i q = _mm_sub_epi8(_mm_loadl_epi64((const __m128i*)(qual + i)), _mm_set1_epi8(33));
+			__m128i clamped = _mm_min_epu8(q, _mm_set1_epi8(93)); // keeps the gathers inside the table
+			vbad = _mm_or_si128(vbad, _mm_xor_si128(q, clamped));
+			row = _mm256_cvtepu8_epi32(clamped);
+		}
+		idx = _mm256_add_epi32(idx, _mm256_mullo_epi32(row, vRowStride));
+		pos = _mm256_add_epi32(pos, step);
+
+		acc0 = _mm256_mul_pd(acc0, _mm256_mask_i32gather_pd(zero, table, _mm256_castsi256_si128(idx), all, 8));
+		acc1 = _mm256_mul_pd(acc1, _mm256_mask_i32gather_pd(zero, table, _mm256_extracti128_si256(idx, 1), all, 8));
+	}
+
+	_mm256_storeu_pd(lanes, _mm256_mul_pd(acc0, acc1));
+	prob = (lanes[0] * lanes[1]) * (lanes[2] * lanes[3]);
+	if (!_mm_testz_si128(vbad, _mm_set_epi64x(0, -1))) bad |= EMISSION_BAD; // the high halves hold no characters
+
+	return prob;
+}
+
+static const bool emissionUseAVX2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+#endif
+
+// exits with the message of get_base_id, get_rbase_id or c2q for the first bad character
+inline void emissionReportBad(const char* read, const char* qual, const char* ref, int dir, int len) {
+	for (int i = 0; i < len; i++) {
+		get_base_id(read[i]);
+		if (ref != NULL) { if (dir == 0) get_base_id(ref[i]); else get_rbase_id(ref[-i]); }
+		if (qual != NULL) assert(qual[i] >= 33 && qual[i] <= 126);
+	}
+}
+
+template<bool hasQual, int refDir>
+inline double emissionProbT(const double* table, const char* read, const char* qual, const char* ref, int rowStride, int refStride, int len) {
+	unsigned int bad = 0;
+	double prob;
+
+#ifdef EMISSION_X86
+	if (emissionUseAVX2) {
+		int len8 = len & ~7;
+		prob = emissionProbAVX2<hasQual, refDir>(table, read, qual, ref, rowStride, refStride, len8, bad);
+		if (len8 < len) prob *= emissionProbScalar<hasQual, refDir>(table, read, qual, ref, rowStride, refStride, len8, len, bad);
+	}
+	else
+#endif
+	prob = emissionProbScalar<hasQual, refDir>(table, read, qual, ref, rowStride, refStride, 0, len, bad);
+
+	if (bad & EMISSION_BAD) emissionReportBad(read, qual, ref, refDir, len);
+	return prob;
+}
+
+template<bool hasQual, int refDir>
+inline void emissionUpdateT(double* table, const char* read, const char* qual, const char* ref, int rowStride, int refStride, int len, double frac) {
+	unsigned int bad = 0;
+
+	for (int i = 0; i < len; i++) {
+		unsigned int idx = emissionIndex<hasQual, refDir>(read, qual, ref, rowStride, refStride, i, bad);
+		if (bad & EMISSION_BAD) emissionReportBad(read, qual, ref, refDir, len);
+		table[idx] += frac;
+	}
+}
+
+/*
+  product of the table entries of the read's bases
+  qual : NULL if the rows are positions in the read
+  ref : NULL if the table has no reference term; otherwise the base aligned to read base 0, the reference is read
+        forwards (dir == 0) or backwards through the complement table (dir == 1)
+*/
+inline double emissionProb(const double* table, const char* read, const char* qual, const char* ref, int dir, int rowStride, int refStride, int len) {
+	if (qual == NULL) {
+		if (ref == NULL) return emissionProbT<false, EMISSION_NOREF>(table, read, qual, ref, rowStride, refStride, len);
+		if (dir == 0) return emissionProbT<false, EMISSION_FWD>(table, read, qual, ref, rowStride, refStride, len);
+		return emissionProbT<false, EMISSION_REV>(table, read, qual, ref, rowStride, refStride, len);
+	}
+	if (ref == NULL) return emissionProbT<true, EMISSION_NOREF>(table, read, qual, ref, rowStride, refStride, len);
+	if (dir == 0) return emissionProbT<true, EMISSION_FWD>(table, read, qual, ref, rowStride, refStride, len);
+	return emissionProbT<true, EMISSION_REV>(table, read, qual, ref, rowStride, refStride, len);
+}
+
+// add frac to the table entries of the read's bases, arguments as for emissionProb
+inline void emissionUpdate(double* table, const char* read, const char* qual, const char* ref, int dir, int rowStride, int refStride, int len, double frac) {
+	if (qual == NULL) {
+		if (ref == NULL) emissionUpdateT<false, EMISSION_NOREF>(table, read, qual, ref, rowStride, refStride, len, frac);
+		else if (dir == 0) emissionUpdateT<false, EMISSION_FWD>(table, read, qual, ref, rowStride, refStride, len, frac);
+		else emissionUpdateT<false, EMISSION_REV>(table, read, qual, ref, rowStride, refStride, len, frac);
+	}
+	else {
+		if (ref == NULL) emissionUpdateT<true, EMISSION_NOREF>(table, read, qual, ref, rowStride, refStride, len, frac);
+		else if (dir == 0) emissionUpdateT<true, EMISSION_FWD>(table, read, qual, ref, rowStride, refStride, len, frac);
+		else emissionUpdateT<true, EMISSION_REV>(table, read, qual, ref, rowStride, refStride, len, frac);
+	}
+}
+
+#endif /* EMISSION_H_ */
@@ -0,0 +1,173 @@
+#ifndef EQUIVCLASSES_H_
+#define EQUIVCLASSES_H_
+
+/**
+Reads grouped by their set of candidate transcripts (the noise transcript 0 is always a candidate) and
+by their conditional probabilities normalized to sum to 1. By default the normalized conditional
+probabilities must be equal bit for bit; setTolerance() lets reads whose normalized conditional
+probabilities differ by up to about a given relative amount share a class (see addWeightKey()).
+
+Each class keeps its multiplicity and, per candidate, the sum of its reads' normalized conditional
+probabilities. The E step of a class treats the class as mult copies of one read whose conditional
+probabilities are the class averages. With exact grouping every read of a class has these conditional
+probabilities, so the E step is the per read one; with a tolerance it is exact up to the tolerance.
+Conditional probabilities must no longer change, i.e. the model must be frozen.
+
+With collapse off, every read becomes a class of its own, which gives a compact store of the normalized
+conditional probabilities for algorithms that only need those (see Components.h).
+
+Sids and weights are kept as two flat arrays (4 + 4 bytes per entry, instead of a whole hit). Weights are
+single precision; since they are normalized per read, single precision loses nothing that matters, while
+raw conditional probabilities could be far below the smallest float.
+
+Storage is compressed, class i owns entries [s[i], s[i + 1]) of sids and weights.
+ */
+
+#include<cmath>
+#include<cstring>
+#include<cassert>
+#include<climits>
+#include<vector>
+#include<map>
+#include<algorithm>
+
+#include "utils.h"
+#include "HitContainer.h"
+
+class EquivClasses {
+public:
+	EquivClasses() { tolerance = 0.0; clear(); }
+
+	// relative difference of normalized conditional probabilities up to which reads share a class, 0 : equal only
+	void setTolerance(double tolerance) { assert(tolerance >= 0.0); this->tolerance = tolerance; }
+
+	void clear();
+	long long getMemory() const { return (long long)s.size() * sizeof(int) + (long long)sids.size() * (sizeof(int) + sizeof(float)) + (long long)mults.size() * sizeof(double); } // in bytes
+
+	// hitvs[i] and ncpvs[i] hold the hits and noise conditional probabilities of the i-th part of the reads
+	template<class HitType>
+	void build(int nParts, HitContainer<HitType> **hitvs, double **ncpvs, bool collapse = true) { build(nParts, hitvs, ncpvs, collapse, NoCallback()); }
+	// partDone(i) is called once part i is no longer needed, e.g. to free its hits while the rest is built
+	template<class HitType, class PartCallback>
+	void build(int nParts, HitContainer<HitType> **hitvs, double **ncpvs, bool collapse, PartCallback partDone);
+
+	int getNC() const { return nc; }
+	int getNEntries() const { return s.back(); }
+	int getNReads() const { return nReads; }
+
+	int getSAt(int pos) const { assert(pos >= 0 && pos <= nc); return s[pos]; }
+	int getSidAt(int pos) const { return sids[pos]; }
+	double getWeightAt(int pos) const { return weights[pos]; }
+
+	// flat views for E step kernels
+	const int* getSids() const { return (sids.empty() ? NULL : &sids[0]); }
+	const float* getWeights() const { return (weights.empty() ? NULL : &weights[0]); }
+	double getMultAt(int pos) const { assert(pos >= 0 && pos < nc); return (mults.empty() ? 1.0 : mults[pos]); } // mults is not kept without collapsing
+
+private:
+	double tolerance;
+	int nc; // number of classes
+	int nReads; // number of reads collapsed into classes
+	std::vector<int> s, sids;
+	std::vector<float> weights;
+	std::vector<double> mults;
+
+	struct NoCallback {
+		void operator() (int) {}
+	};
+
+	// appends w to a class key: its bits, or with a tolerance its log on a grid of log(1 + tolerance) steps
+	void addWeightKey(std::vector<int>& key, double w) const {
+		if (tolerance <= 0.0) {
+			int bits[2];
+			memcpy(bits, &w, sizeof(double));
+			key.push_back(bits[0]); key.push_back(bits[1]);
+		}
+		else key.push_back(w < EPSILON ? INT_MIN : (int)floor(log(w) / log(1.0 + tolerance) + 0.5));
+	}
+};
+
+void EquivClasses::clear() {
+	nc = nReads = 0;
+	s.assign(1, 0);
+	std::vector<int>().swap(sids);
+	std::vector<float>().swap(weights);
+	std::vector<double>().swap(mults);
+}
+
+template<class HitType, class PartCallback>
+void EquivClasses::build(int nParts, HitContainer<HitType> **hitvs, double **ncpvs, bool collapse, PartCallback partDone) {
+	std::map<std::vector<int>, int> index; // sid list followed by the keys of the normalized weights -> class id
+	std::map<std::vector<int>, int>::iterator iter;
+	std::vector<std::pair<int, double> > cands;
+	std::vector<int> key;
+	std::vector<double> ws;
+	std::vector<double> acc; // class weights are summed in double precision
+	double sum;
+	int cid;
+
+	clear();
+
+	if (!collapse) {
+		int nEntries = 0, nTotal = 0;
+		for (int i = 0; i < nParts; i++) { nEntries += hitvs[i]->getNHits(); nTotal += hitvs[i]->getN(); }
+		s.reserve(nTotal + 1);
+		sids.reserve(nEntries + nTotal); weights.reserve(nEntries + nTotal);
+	}
+
+	for (int i = 0; i < nParts; i++) {
+		int N = hitvs[i]->getN();
+		for (int j = 0; j < N; j++) {
+			int fr = hitvs[i]->getSAt(j), to = hitvs[i]->getSAt(j + 1);
+
+			cands.clear();
+			for (int k = fr; k < to; k++) {
+				HitType &hit = hitvs[i]->getHitAt(k);
+				cands.push_back(std::make_pair(hit.getSid(), hit.getConPrb()));
+			}
+			sort(cands.begin(), cands.end());
+
+			// a read may align to one transcript several times, merge those hits
+			key.assign(1, 0);
+			ws.assign(1, ncpvs[i][j]);
+			sum = ncpvs[i][j];
+			for (int k = 0; k < (int)cands.size(); k++) {
+				if (cands[k].first == key.back()) ws.back() += cands[k].second;
+				else { key.push_back(cands[k].first); ws.push_back(cands[k].second); }
+				sum += cands[k].second;
+			}
+
+			if (sum < EPSILON) continue; // contributes nothing to the E step
+
+			int len = key.size();
+			if (collapse)
+				for (int k = 0; k < len; k++) addWeightKey(key, ws[k] / sum);
+
+			if (!collapse) {
+				for (int k = 0; k < len; k++) { sids.push_back(key[k]); weights.push_back(ws[k] / sum); }
+				s.push_back(sids.size());
+				++nc; ++nReads;
+				continue;
+			}
+
+			iter = index.find(key);
+			if (iter == index.end()) {
+				cid = nc++;
+				index[key] = cid;
+				for (int k = 0; k < len; k++) { sids.push_back(key[k]); acc.push_back(0.0); }
+				s.push_back(sids.size());
+				mults.push_back(0.0);
+			}
+			else cid = iter->second;
+
+			for (int k = 0; k < len; k++) acc[s[cid] + k] += ws[k] / sum;
+			mults[cid] += 1.0;
+			++nReads;
+		}
+		partDone(i);
+	}
+
+	if (collapse) weights.assign(acc.begin(), acc.end());
+}
+
+#endif /* EQUIVCLASSES_H_ */
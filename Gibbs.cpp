@@ -1,15 +1,19 @@
 #include<cstdio>
 #include<cstring>
 #include<cstdlib>
+#include<cmath>
 #include<cassert>
 #include<fstream>
-#include<sstream>
 #include<vector>
+#include<utility>
+#include<algorithm>
 #include<pthread.h>
 
 #include "utils.h"
 #include "my_assert.h"
 #include "sampling.h"
+#include "WorkerPool.h"
+#include "ChainStats.h"
 
 #include "Model.h"
 #include "SingleModel.h"
@@ -19,29 +23,64 @@
 
 #include "Refs.h"
 #include "GroupInfo.h"
+#include "OfgFile.h"
 
 using namespace std;
 
+/*
+  Adaptive burn-in: the log joint probability of the chain state (up to a constant) is traced, and burn-in ends
+  once its means over the last two windows of BURNIN_WINDOW rounds differ by less than two standard errors,
+  i.e. the trace no longer drifts. Autocorrelation makes the standard errors too small, which only makes the
+  test stricter. BURNIN is the upper limit.
+ */
+const int BURNIN_WINDOW = 20;
+
+class BurnInMonitor {
+public:
+	// returns true if the chain looks stationary after adding the value of this round
+	bool add(double value) {
+		trace.push_back(value);
+		int n = trace.size();
+		if (n < 2 * BURNIN_WINDOW) return false;
+
+		double meanA, varA, meanB, varB;
+		stats(n - 2 * BURNIN_WINDOW, meanA, varA);
+		stats(n - BURNIN_WINDOW, meanB, varB);
+
+		return fabs(meanA - meanB) <= 2.0 * sqrt((varA + varB) / BURNIN_WINDOW);
+	}
+
+private:
+	vector<double> trace;
+
+	void stats(int fr, double& mean, double& var) {
+		mean = var = 0.0;
+		for (int i = fr; i < fr + BURNIN_WINDOW; i++) mean += trace[i];
+		mean /= BURNIN_WINDOW;
+		for (int i = fr; i < fr + BURNIN_WINDOW; i++) var += (trace[i] - mean) * (trace[i] - mean);
+		var /= BURNIN_WINDOW - 1;
+	}
+};
+
 struct Params {
 	int no, nsamples;
 	FILE *fo;
 	engine_type *engine;
 	double *pme_c, *pve_c; //posterior mean and variance vectors on counts
 	double *pme_theta;
-};
-
 
-struct Item {
-	int sid;
-	double conprb;
-
-	Item(int sid, double conprb) {
-		this->sid = sid;
-		this->conprb = conprb;
-	}
+	// state of the chain, kept between calls of Gibbs
+	uniform01 *rg;
+	vector<int> z, counts;
+	vector<double> arr;
+	int round, burnin; // rounds done, rounds of burn-in
+	int recorded, limit; // samples recorded, Gibbs returns once limit samples are recorded
+	BurnInMonitor *monitor;
+	ChainStats *stats; // NULL without diagnostics
 };
 
 int nThreads;
+int nWorkers; // threads sharing the chain with --components
 
 int model_type;
 int m, M, N0, N1, nHits;
@@ -54,15 +93,46 @@ char cvsF[STRLEN];
 Refs refs;
 GroupInfo gi;
 
-vector<int> s;
-vector<Item> hits;
+OfgFile ofgFile; // s, sids and conprbs point into this mapping
+const int *s; // candidates of read i are [s[i], s[i + 1])
+const int *sids;
+const double *conprbs;
 
-vector<double> theta;
+/*
+  A read with a single candidate is always assigned to it, so such reads are added to the counts once,
+  at load time, and only reads with several candidates are sampled.
+ */
+vector<int> multiReads; // reads with more than one candidate
+vector<int> uniqCounts; // uniqCounts[i] : number of reads whose only candidate is i
+int maxLen; // largest number of candidates of a read
+
+vector<double> theta; // the EM estimate
 
 vector<double> pme_c, pve_c; //global posterior mean and variance vectors on counts
 vector<double> pme_theta, eel;
 
 bool var_opt;
+bool useComponents;
+bool emInit; // start chains near the EM estimate instead of from Dir(1)
+bool adaptiveBurnIn; // stop burn-in once the chain looks stationary, BURNIN is the limit
+
+/*
+  Convergence diagnostics. With diagnostics on, every chain keeps a ChainStats of its count vectors, and the
+  ESS and split-chain R-hat of every transcript are written to statName.gibbs_diagnostics. With stopping rules,
+  the chains run DIAG_INTERVAL samples at a time and stop, at the latest after NSAMPLES samples, as soon as every
+  transcript with a posterior mean count of at least DIAG_MIN_COUNT has an ESS of at least targetESS and an
+  R-hat of at most maxRhat, or timeLimit seconds have passed. Transcripts with smaller counts are left out
+  because their rare non-zero samples make both numbers too noisy to wait for.
+ */
+const int DIAG_INTERVAL = 20; // samples per chain between checks of the stopping rules
+const double DIAG_MIN_COUNT = 1.0;
+
+bool diagnostics;
+bool stopping; // whether any stopping rule is set
+double targetESS, maxRhat, timeLimit; // stopping rules, 0 if not used
+double startTime;
+int totSamples; // samples recorded by all chains
+vector<ChainStats*> chainStats; // one per chain
 bool quiet;
 
 Params *paramsArray;
@@ -73,7 +143,6 @@ int rc;
 
 void load_data(char* reference_name, char* statName, char* imdName) {
 	ifstream fin;
-	string line;
 	int tmpVal;
 
 	//load reference file
@@ -98,28 +167,25 @@ void load_data(char* reference_name, char* statName, char* imdName) {
 
 	//load ofgF;
 	sprintf(ofgF, "%s.ofg", imdName);
-	fin.open(ofgF);
-	general_assert(fin.is_open(), "Cannot open " + cstrtos(ofgF) + "!");
-	fin>>tmpVal>>N0;
-	general_assert(tmpVal == M, "M in " + cstrtos(ofgF) + " is not consistent with " + cstrtos(refF) + "!");
-	getline(fin, line);
-
-	s.clear(); hits.clear();
-	s.push_back(0);
-	while (getline(fin, line)) {
-		istringstream strin(line);
-		int sid;
-		double conprb;
-
-		while (strin>>sid>>conprb) {
-			hits.push_back(Item(sid, conprb));
-		}
-		s.push_back(hits.size());
+	ofgFile.map(ofgF);
+	general_assert(ofgFile.getM() == M, "M in " + cstrtos(ofgF) + " is not consistent with " + cstrtos(refF) + "!");
+	N0 = ofgFile.getN0();
+	N1 = ofgFile.getN();
+	nHits = ofgFile.getNEntries();
+	s = ofgFile.getOffsets();
+	sids = ofgFile.getSids();
+	conprbs = ofgFile.getConPrbs();
+
+	multiReads.clear();
+	uniqCounts.assign(M + 1, 0);
+	maxLen = 0;
+	for (int i = 0; i < N1; i++) {
+		int len = s[i + 1] - s[i];
+		if (len > 1) multiReads.push_back(i);
+		else ++uniqCounts[sids[s[i]]];
+		if (maxLen < len) maxLen = len;
 	}
-	fin.close();
-
-	N1 = s.size() - 1;
-	nHits = hits.size();
+	if (verbose) { printf("%d of %d reads have a single candidate, %d reads are sampled\n", N1 - (int)multiReads.size(), N1, (int)multiReads.size()); }
 
 	totc = N0 + N1 + (M + 1);
 
@@ -148,6 +214,12 @@ void init() {
 		paramsArray[i].fo = fopen(outF, "w");
 
 		paramsArray[i].engine = engineFactory::new_engine();
+		paramsArray[i].rg = new uniform01(*paramsArray[i].engine);
+		paramsArray[i].round = paramsArray[i].burnin = 0;
+		paramsArray[i].recorded = paramsArray[i].limit = 0;
+		paramsArray[i].monitor = new BurnInMonitor();
+		paramsArray[i].stats = NULL;
+		if (diagnostics && !useComponents) { paramsArray[i].stats = new ChainStats(M + 1); chainStats.push_back(paramsArray[i].stats); }
 		paramsArray[i].pme_c = new double[M + 1];
 		memset(paramsArray[i].pme_c, 0, sizeof(double) * (M + 1));
 		paramsArray[i].pve_c = new double[M + 1];
@@ -179,6 +251,27 @@ void sampleTheta(engine_type& engine, vector<double>& theta) {
 	for (int i = 0; i <= M; i++) theta[i] /= denom;
 }
 
+// sample from Dir(1 + theta * (N0 + N1)), i.e. around the EM estimate with the spread of a posterior given its expected counts, so chains start near the mode but not all at the same point
+void sampleThetaNearEM(engine_type& engine, vector<double>& initTheta) {
+	double denom;
+
+	initTheta.assign(M + 1, 0);
+	denom = 0.0;
+	for (int i = 0; i <= M; i++) {
+		initTheta[i] = gamma_generator(engine, gamma_dist(1.0 + theta[i] * (N0 + N1)))();
+		denom += initTheta[i];
+	}
+	assert(denom > EPSILON);
+	for (int i = 0; i <= M; i++) initTheta[i] /= denom;
+}
+
+// log joint probability of the assignments (up to a constant): sum of log Gamma of the counts plus the log conditional probabilities of the chosen candidates
+double logJoint(const vector<int>& counts, double logConPrbs) {
+	double value = logConPrbs;
+	for (int i = 0; i <= M; i++) value += lgamma((double)counts[i]);
+	return value;
+}
+
 void writeCountVector(FILE* fo, vector<int>& counts) {
 	for (int i = 0; i < M; i++) {
 		fprintf(fo, "%d ", counts[i]);
@@ -186,61 +279,155 @@ void writeCountVector(FILE* fo, vector<int>& counts) {
 	fprintf(fo, "%d\n", counts[M]);
 }
 
-void* Gibbs(void* arg) {
-	int len, fr, to;
-	int CHAINLEN;
-	Params *params = (Params*)arg;
-
+// draw theta from Dir(1), or around the EM estimate with --em-init, and assign each read of reads according to it, counts get 1 pseudo count plus the reads whose assignment is fixed
+void initChain(engine_type& engine, uniform01& rg, const vector<int>& reads, vector<int>& z, vector<int>& counts, vector<double>& arr) {
+	int fr, to, len;
 	vector<double> theta;
-	vector<int> z, counts;
-	vector<double> arr;
 
-	uniform01 rg(*params->engine);
+	if (emInit) sampleThetaNearEM(engine, theta);
+	else sampleTheta(engine, theta);
 
-	// generate initial state
-	sampleTheta(*params->engine, theta);
-
-	z.assign(N1, 0);
+	z.assign(reads.size(), 0); // z[k] : transcript read reads[k] is assigned to
+	arr.assign(maxLen, 0.0);
 
 	counts.assign(M + 1, 1); // 1 pseudo count
 	counts[0] += N0;
+	for (int i = 0; i <= M; i++) counts[i] += uniqCounts[i];
 
-	for (int i = 0; i < N1; i++) {
-		fr = s[i]; to = s[i + 1];
+	for (int i = 0; i < (int)reads.size(); i++) {
+		fr = s[reads[i]]; to = s[reads[i] + 1];
 		len = to - fr;
-		arr.assign(len, 0);
 		for (int j = fr; j < to; j++) {
-			arr[j - fr] = theta[hits[j].sid] * hits[j].conprb;
+			arr[j - fr] = theta[sids[j]] * conprbs[j];
 			if (j > fr) arr[j - fr] += arr[j - fr - 1];  // cumulative
 		}
-		z[i] = hits[fr + sample(rg, arr, len)].sid;
+		z[i] = sids[fr + sample(rg, arr, len)];
 		++counts[z[i]];
 	}
+}
+
+void recordSample(Params* params, vector<int>& counts) {
+	++params->recorded;
+	writeCountVector(params->fo, counts);
+	for (int i = 0; i <= M; i++) {
+		params->pme_c[i] += counts[i] - 1;
+		params->pve_c[i] += (counts[i] - 1) * (counts[i] - 1);
+		params->pme_theta[i] += counts[i] / totc;
+	}
+}
+
+// smallest ESS and largest R-hat over the transcripts with a posterior mean count of at least DIAG_MIN_COUNT, returns their number
+int summarizeDiagnostics(double& minESS, double& worstRhat) {
+	int nChecked = 0;
+	double mean, ess, rhat;
+
+	minESS = HUGE_VAL; worstRhat = 1.0;
+	for (int i = 1; i <= M; i++) {
+		ChainStats::calcDiagnostics(chainStats, i, mean, ess, rhat);
+		if (mean - 1.0 < DIAG_MIN_COUNT) continue; // 1 pseudo count
+		++nChecked;
+		minESS = min(minESS, ess);
+		worstRhat = max(worstRhat, rhat);
+	}
+
+	return nChecked;
+}
+
+// total : samples recorded by all chains so far
+bool shouldStop(int total) {
+	double minESS, worstRhat;
+	bool met;
+
+	if (total < 2) return false; // the posterior variance needs two samples
+	if (timeLimit > 0.0 && WorkerPool::getTime() - startTime >= timeLimit) {
+		if (verbose) { printf("Time limit reached, sampling stopped after %d samples!\n", total); }
+		return true;
+	}
+	if ((targetESS <= 0.0 && maxRhat <= 0.0) || !ChainStats::isReady(chainStats)) return false;
+
+	summarizeDiagnostics(minESS, worstRhat);
+	met = (targetESS <= 0.0 || minESS >= targetESS) && (maxRhat <= 0.0 || worstRhat <= maxRhat);
+	if (verbose) { printf("%d samples: min ESS = %.1f, max R-hat = %.4f%s\n", total, minESS, worstRhat, (met ? ", sampling stopped" : "")); }
+
+	return met;
+}
+
+void writeDiagnostics() {
+	char diagF[STRLEN];
+	double mean, ess, rhat, minESS, worstRhat;
+	int nChecked;
+	bool ready = ChainStats::isReady(chainStats);
+
+	sprintf(diagF, "%s.gibbs_diagnostics", statName);
+	FILE *fo = fopen(diagF, "w");
+	general_assert(fo != NULL, "Cannot open " + cstrtos(diagF) + "!");
+
+	fprintf(fo, "#samples\t%d\n", totSamples);
+	fprintf(fo, "#chains\t%d\n", (int)chainStats.size());
+	if (ready) {
+		nChecked = summarizeDiagnostics(minESS, worstRhat);
+		fprintf(fo, "#checked_transcripts\t%d\n", nChecked);
+		if (nChecked > 0) fprintf(fo, "#min_ess\t%.2f\n#max_rhat\t%.4f\n", minESS, worstRhat);
+	}
+	else fprintf(fo, "#too few samples for diagnostics\n");
+
+	fprintf(fo, "transcript_id\tposterior_mean_count\tess\trhat\n");
+	for (int i = 1; i <= M; i++) {
+		fprintf(fo, "%s\t%.2f", refs.getRef(i).getName().c_str(), pme_c[i]);
+		if (ready) {
+			ChainStats::calcDiagnostics(chainStats, i, mean, ess, rhat);
+			fprintf(fo, "\t%.2f\t%.4f\n", ess, rhat);
+		}
+		else fprintf(fo, "\tNA\tNA\n");
+	}
+	fclose(fo);
+
+	if (verbose) { printf("Diagnostics are written to %s!\n", diagF); }
+}
+
+void* Gibbs(void* arg) {
+	int len, fr, to, nMulti, k;
+	double logConPrbs;
+	Params *params = (Params*)arg;
+
+	vector<int> &z = params->z, &counts = params->counts;
+	vector<double> &arr = params->arr;
+
+	nMulti = multiReads.size();
+	if (params->round == 0) {
+		// generate initial state
+		initChain(*params->engine, *params->rg, multiReads, z, counts, arr);
+		params->burnin = BURNIN;
+	}
 
 	// Gibbs sampling
-	CHAINLEN = 1 + (params->nsamples - 1) * GAP;
-	for (int ROUND = 1; ROUND <= BURNIN + CHAINLEN; ROUND++) {
+	while (params->recorded < params->limit) {
+		int ROUND = ++params->round;
+		bool monitored = adaptiveBurnIn && ROUND <= params->burnin;
 
-		for (int i = 0; i < N1; i++) {
+		logConPrbs = 0.0;
+		for (int i = 0; i < nMulti; i++) {
 			--counts[z[i]];
-			fr = s[i]; to = s[i + 1]; len = to - fr;
-			arr.assign(len, 0);
+			fr = s[multiReads[i]]; to = s[multiReads[i] + 1]; len = to - fr;
 			for (int j = fr; j < to; j++) {
-				arr[j - fr] = counts[hits[j].sid] * hits[j].conprb;
+				arr[j - fr] = counts[sids[j]] * conprbs[j];
 				if (j > fr) arr[j - fr] += arr[j - fr - 1]; //cumulative
 			}
-			z[i] = hits[fr + sample(rg, arr, len)].sid;
+			k = fr + sample(*params->rg, arr, len);
+			z[i] = sids[k];
 			++counts[z[i]];
+			if (monitored) logConPrbs += log(conprbs[k]);
+		}
+
+		if (monitored && params->monitor->add(logJoint(counts, logConPrbs))) {
+			params->burnin = ROUND;
+			if (verbose) { printf("Thread %d, burn-in stopped after %d rounds\n", params->no, ROUND); }
 		}
 
-		if (ROUND > BURNIN) {
-			if ((ROUND - BURNIN - 1) % GAP == 0) {
-				writeCountVector(params->fo, counts);
-				for (int i = 0; i <= M; i++) {
-					params->pme_c[i] += counts[i] - 1;
-					params->pve_c[i] += (counts[i] - 1) * (counts[i] - 1);
-					params->pme_theta[i] += counts[i] / totc;
-				}
+		if (ROUND > params->burnin) {
+			if ((ROUND - params->burnin - 1) % GAP == 0) {
+				recordSample(params, counts);
+				if (params->stats != NULL) params->stats->add(counts);
 			}
 		}
 
@@ -250,6 +437,228 @@ void* Gibbs(void* arg) {
 	return NULL;
 }
 
+/*
+  With --components, one chain is run and each sweep is split over threads by connected component (transcripts
+  linked by reads with several candidates). The only count components share is that of the noise transcript,
+  so the chain is partially collapsed: the Dir(1) prior splits into the weights of the noise transcript and of
+  each component, which are sampled given the assignments before every sweep, and the fractions of transcripts
+  inside a component, which stay collapsed. With the weights fixed, a read only sees counts of its own component,
+  so components are swept in parallel without locks and the chain still has the same stationary distribution.
+ */
+int nComp;
+vector<int> compOf; // component of each transcript, -1 if no read with several candidates has it
+vector<int> compRS, compReads; // reads of component c are compReads[compRS[c] .. compRS[c + 1])
+vector<int> compZ, compCounts; // state of the chain, compZ[k] : transcript read compReads[k] is assigned to
+vector<int> compTot, compNoise; // per component, sum of counts of its transcripts and number of its reads assigned to noise
+vector<double> compW; // weight of each component in this sweep
+double noiseW; // weight of the noise transcript in this sweep
+int nextComp; // next component to be handed out
+
+bool compMonitored; // whether the log conditional probabilities are summed in this sweep
+
+struct CompWorker {
+	engine_type *engine;
+	uniform01 *rg; // keeps its own copy of the engine state, so it must live as long as the chain
+	vector<double> arr;
+	double logConPrbs;
+};
+
+void buildComponents() {
+	vector<int> parent, root2comp, cnt;
+	vector<long long> size;
+	vector<pair<long long, int> > bySize;
+	int nMulti = multiReads.size();
+
+	parent.resize(M + 1);
+	for (int i = 0; i <= M; i++) parent[i] = i;
+
+	// a read links all of its candidates except the noise transcript
+	vector<int> readComp(nMulti, -1); // a transcript of each read, then its component
+	for (int i = 0; i < nMulti; i++) {
+		int a = -1;
+		for (int j = s[multiReads[i]]; j < s[multiReads[i] + 1]; j++) {
+			if (sids[j] == 0) continue;
+			int b = sids[j];
+			while (parent[b] != b) { parent[b] = parent[parent[b]]; b = parent[b]; }
+			if (a < 0) a = b;
+			else if (a != b) parent[b] = a;
+		}
+		readComp[i] = a;
+	}
+
+	nComp = 0;
+	root2comp.assign(M + 1, -1);
+	for (int i = 0; i < nMulti; i++) {
+		int a = readComp[i];
+		while (parent[a] != a) a = parent[a];
+		if (root2comp[a] < 0) { root2comp[a] = nComp++; size.push_back(0); }
+		readComp[i] = root2comp[a];
+		size[readComp[i]] += s[multiReads[i] + 1] - s[multiReads[i]];
+	}
+
+	// handing out the biggest components first keeps the threads busy until the end of a sweep
+	for (int c = 0; c < nComp; c++) bySize.push_back(make_pair(-size[c], c));
+	sort(bySize.begin(), bySize.end());
+	vector<int> order(nComp);
+	for (int c = 0; c < nComp; c++) order[bySize[c].second] = c;
+
+	compOf.assign(M + 1, -1);
+	for (int i = 1; i <= M; i++) {
+		int a = i;
+		while (parent[a] != a) a = parent[a];
+		if (root2comp[a] >= 0) compOf[i] = order[root2comp[a]];
+	}
+
+	cnt.assign(nComp + 1, 0);
+	for (int i = 0; i < nMulti; i++) ++cnt[order[readComp[i]] + 1];
+	for (int c = 0; c < nComp; c++) cnt[c + 1] += cnt[c];
+	compRS = cnt;
+	compReads.resize(nMulti);
+	for (int i = 0; i < nMulti; i++) compReads[cnt[order[readComp[i]]]++] = multiReads[i];
+
+	if (verbose) { printf("%d connected components, the largest has %lld candidates\n", nComp, (nComp > 0 ? -bySize[0].first : 0LL)); }
+}
+
+void sweepComponent(int c, CompWorker* worker) {
+	int len, fr, to, zz, j;
+	double ratio;
+	vector<double> &arr = worker->arr;
+
+	for (int k = compRS[c]; k < compRS[c + 1]; k++) {
+		zz = compZ[k];
+		if (zz == 0) --compNoise[c];
+		else { --compCounts[zz]; --compTot[c]; }
+
+		fr = s[compReads[k]]; to = s[compReads[k] + 1]; len = to - fr;
+		ratio = compW[c] / compTot[c];
+		for (j = fr; j < to; j++) {
+			arr[j - fr] = (sids[j] == 0 ? noiseW : compCounts[sids[j]] * ratio) * conprbs[j];
+			if (j > fr) arr[j - fr] += arr[j - fr - 1]; //cumulative
+		}
+		j = fr + sample(*worker->rg, arr, len);
+		zz = compZ[k] = sids[j];
+		if (compMonitored) worker->logConPrbs += log(conprbs[j]);
+
+		if (zz == 0) ++compNoise[c];
+		else { ++compCounts[zz]; ++compTot[c]; }
+	}
+}
+
+void* sweepComponents(void* arg) {
+	CompWorker *worker = (CompWorker*)arg;
+	int c;
+
+	while ((c = __sync_fetch_and_add(&nextComp, 1)) < nComp) sweepComponent(c, worker);
+
+	return NULL;
+}
+
+// a single chain whose sweeps are shared by nWorkers threads; sample k is recorded in paramsArray[k % nThreads]
+void runComponentChain(int nWorkers) {
+	int CHAINLEN, noiseBase, sampled, burnin;
+	double logConPrbs;
+	BurnInMonitor monitor;
+	engine_type *engine = engineFactory::new_engine();
+	uniform01 rg(*engine);
+	WorkerPool pool(nWorkers);
+	vector<CompWorker> workers(nWorkers);
+	vector<void*> args(nWorkers);
+	ChainStats *stats = NULL;
+
+	buildComponents();
+	if (diagnostics) { stats = new ChainStats(M + 1); chainStats.push_back(stats); }
+
+	initChain(*engine, rg, compReads, compZ, compCounts, workers[0].arr);
+
+	noiseBase = compCounts[0];
+	compTot.assign(nComp, 0);
+	compNoise.assign(nComp, 0);
+	for (int c = 0; c < nComp; c++)
+		for (int k = compRS[c]; k < compRS[c + 1]; k++)
+			if (compZ[k] == 0) { ++compNoise[c]; --noiseBase; }
+	for (int i = 1; i <= M; i++)
+		if (compOf[i] >= 0) compTot[compOf[i]] += compCounts[i];
+
+	for (int i = 0; i < nWorkers; i++) {
+		workers[i].engine = engineFactory::new_engine();
+		workers[i].rg = new uniform01(*workers[i].engine);
+		workers[i].arr.assign(maxLen, 0.0);
+		args[i] = (void*)(&workers[i]);
+	}
+	compW.assign(nComp, 0.0);
+
+	sampled = 0;
+	CHAINLEN = 1 + (NSAMPLES - 1) * GAP;
+	burnin = BURNIN;
+	for (int ROUND = 1; ROUND <= burnin + CHAINLEN; ROUND++) {
+		// weights given the assignments: (noise, components) ~ Dir(counts[0], compTot), only their ratios matter
+		noiseW = gamma_generator(*engine, gamma_dist(compCounts[0]))();
+		for (int c = 0; c < nComp; c++) compW[c] = gamma_generator(*engine, gamma_dist(compTot[c]))();
+
+		nextComp = 0;
+		compMonitored = adaptiveBurnIn && ROUND <= burnin;
+		for (int i = 0; i < nWorkers; i++) workers[i].logConPrbs = 0.0;
+		pool.run(sweepComponents, &args[0]);
+
+		compCounts[0] = noiseBase;
+		for (int c = 0; c < nComp; c++) compCounts[0] += compNoise[c];
+
+		if (compMonitored) {
+			logConPrbs = 0.0;
+			for (int i = 0; i < nWorkers; i++) logConPrbs += workers[i].logConPrbs;
+			if (monitor.add(logJoint(compCounts, logConPrbs))) {
+				burnin = ROUND;
+				if (verbose) { printf("Burn-in stopped after %d rounds\n", burnin); }
+			}
+		}
+
+		if (ROUND > burnin) {
+			if ((ROUND - burnin - 1) % GAP == 0) {
+				recordSample(&paramsArray[sampled % nThreads], compCounts);
+				++sampled;
+				if (stats != NULL) stats->add(compCounts);
+				if (stopping && sampled % DIAG_INTERVAL == 0 && shouldStop(sampled)) break;
+			}
+		}
+
+		if (verbose && ROUND % 100 == 0) { printf("ROUND %d is finished!\n", ROUND); }
+	}
+	assert(sampled == NSAMPLES || stopping);
+
+	for (int i = 0; i < nWorkers; i++) {
+		delete workers[i].rg;
+		delete workers[i].engine;
+	}
+	delete engine;
+}
+
+// run the chains of the threads to their number of samples, or with stopping rules until the rules say so
+void runChains() {
+	bool allDone;
+	int total;
+
+	do {
+		for (int i = 0; i < nThreads; i++)
+			paramsArray[i].limit = (stopping ? min(paramsArray[i].nsamples, paramsArray[i].recorded + DIAG_INTERVAL) : paramsArray[i].nsamples);
+
+		for (int i = 0; i < nThreads; i++) {
+			rc = pthread_create(&threads[i], &attr, Gibbs, (void*)(&paramsArray[i]));
+			pthread_assert(rc, "pthread_create", "Cannot create thread " + itos(i) + " (numbered from 0)!");
+		}
+		for (int i = 0; i < nThreads; i++) {
+			rc = pthread_join(threads[i], &status);
+			pthread_assert(rc, "pthread_join", "Cannot join thread " + itos(i) + " (numbered from 0)!");
+		}
+
+		allDone = true;
+		total = 0;
+		for (int i = 0; i < nThreads; i++) {
+			if (paramsArray[i].recorded < paramsArray[i].nsamples) allDone = false;
+			total += paramsArray[i].recorded;
+		}
+	} while (!allDone && !shouldStop(total));
+}
+
 void release() {
 //	char inpF[STRLEN], command[STRLEN];
 	string line;
@@ -261,9 +670,13 @@ void release() {
 	pme_c.assign(M + 1, 0);
 	pve_c.assign(M + 1, 0);
 	pme_theta.assign(M + 1, 0);
+	totSamples = 0;
 	for (int i = 0; i < nThreads; i++) {
+		totSamples += paramsArray[i].recorded;
 		fclose(paramsArray[i].fo);
+		delete paramsArray[i].rg;
 		delete paramsArray[i].engine;
+		delete paramsArray[i].monitor;
 		for (int j = 0; j <= M; j++) {
 			pme_c[j] += paramsArray[i].pme_c[j];
 			pve_c[j] += paramsArray[i].pve_c[j];
@@ -277,9 +690,9 @@ void release() {
 
 
 	for (int i = 0; i <= M; i++) {
-		pme_c[i] /= NSAMPLES;
-		pve_c[i] = (pve_c[i] - NSAMPLES * pme_c[i] * pme_c[i]) / (NSAMPLES - 1);
-		pme_theta[i] /= NSAMPLES;
+		pme_c[i] /= totSamples;
+		pve_c[i] = (pve_c[i] - totSamples * pme_c[i] * pme_c[i]) / (totSamples - 1);
+		pme_theta[i] /= totSamples;
 	}
 
 	/*
@@ -419,7 +832,13 @@ void writeEstimatedParameters(char* modelF, char* imdName) {
 
 int main(int argc, char* argv[]) {
 	if (argc < 7) {
-		printf("Usage: rsem-run-gibbs-multi reference_name sample_name sampleToken BURNIN NSAMPLES GAP [-p #Threads] [--var] [-q]\n");
+		printf("Usage: rsem-run-gibbs-multi reference_name sample_name sampleToken BURNIN NSAMPLES GAP [-p #Threads] [--var] [--components] [--em-init] [--adaptive-burnin] [--diagnostics] [--target-ess value] [--max-rhat value] [--time-limit seconds] [-q]\n");
+		printf("  --components: run a single chain and split each round over the threads by connected component of transcripts, so the burn-in is done once instead of once per thread (default: one chain per thread)\n");
+		printf("  --em-init: start each chain from assignments drawn around the EM estimate instead of from a Dir(1) draw (default: off)\n");
+		printf("  --adaptive-burnin: end the burn-in of a chain as soon as its log joint probability stops drifting, with BURNIN as the upper limit (default: off)\n");
+		printf("  --diagnostics: write the effective sample size and split-chain R-hat of every transcript to sample_name.stat/sample_name.gibbs_diagnostics (default: off)\n");
+		printf("  --target-ess, --max-rhat: stop sampling, at the latest after NSAMPLES samples, once every transcript with a posterior mean count of at least %g has at least this effective sample size (summed over chains) and at most this R-hat; implies --diagnostics (default: off)\n", DIAG_MIN_COUNT);
+		printf("  --time-limit: stop sampling once this many seconds have passed (default: off)\n");
 		exit(-1);
 	}
 
@@ -432,36 +851,49 @@ int main(int argc, char* argv[]) {
 
 	nThreads = 1;
 	var_opt = false;
+	useComponents = false;
+	emInit = adaptiveBurnIn = false;
+	diagnostics = false;
+	targetESS = maxRhat = timeLimit = 0.0;
 	quiet = false;
 
 	for (int i = 7; i < argc; i++) {
 		if (!strcmp(argv[i], "-p")) nThreads = atoi(argv[i + 1]);
 		if (!strcmp(argv[i], "--var")) var_opt = true;
+		if (!strcmp(argv[i], "--components")) useComponents = true;
+		if (!strcmp(argv[i], "--em-init")) emInit = true;
+		if (!strcmp(argv[i], "--adaptive-burnin")) adaptiveBurnIn = true;
+		if (!strcmp(argv[i], "--diagnostics")) diagnostics = true;
+		if (!strcmp(argv[i], "--target-ess")) targetESS = atof(argv[i + 1]);
+		if (!strcmp(argv[i], "--max-rhat")) maxRhat = atof(argv[i + 1]);
+		if (!strcmp(argv[i], "--time-limit")) timeLimit = atof(argv[i + 1]);
 		if (!strcmp(argv[i], "-q")) quiet = true;
 	}
 	verbose = !quiet;
+	stopping = targetESS > 0.0 || maxRhat > 0.0 || timeLimit > 0.0;
+	if (targetESS > 0.0 || maxRhat > 0.0) diagnostics = true;
 
 	assert(NSAMPLES > 1); // Otherwise, we cannot calculate posterior variance
 
+	// the samples still go to one count vector file per thread, as rsem-calculate-credibility-intervals expects
+	nWorkers = nThreads;
 	if (nThreads > NSAMPLES) {
 		nThreads = NSAMPLES;
-		printf("Warning: Number of samples is less than number of threads! Change the number of threads to %d!\n", nThreads);
+		if (!useComponents) printf("Warning: Number of samples is less than number of threads! Change the number of threads to %d!\n", nThreads);
 	}
 
 	if (verbose) printf("Gibbs started!\n");
 
+	startTime = WorkerPool::getTime();
 	init();
-	for (int i = 0; i < nThreads; i++) {
-		rc = pthread_create(&threads[i], &attr, Gibbs, (void*)(&paramsArray[i]));
-		pthread_assert(rc, "pthread_create", "Cannot create thread " + itos(i) + " (numbered from 0)!");
-	}
-	for (int i = 0; i < nThreads; i++) {
-		rc = pthread_join(threads[i], &status);
-		pthread_assert(rc, "pthread_join", "Cannot join thread " + itos(i) + " (numbered from 0)!");
-	}
+	if (useComponents) runComponentChain(nWorkers);
+	else runChains();
 	release();
 
-	if (verbose) printf("Gibbs finished!\n");
+	if (verbose) printf("Gibbs finished with %d samples!\n", totSamples);
+
+	if (diagnostics) writeDiagnostics();
+	for (int i = 0; i < (int)chainStats.size(); i++) delete chainStats[i];
 
 	sprintf(modelF, "%s.model", statName);
 	FILE *fi = fopen(modelF, "r");
@@ -2,7 +2,6 @@
 #define HITCONTAINER_H_
 
 #include<cassert>
-#include<iostream>
 #include<vector>
 
 #include<algorithm>
@@ -21,14 +20,26 @@ public:
 		hits.clear();
 
 		s.push_back(0);
+		syncView();
 	}
 
-	bool read(std::istream&); // each time a read
-	void write(std::ostream&); // write all reads' hit out
+	// refer to reads [fr, to) of an external hit store (e.g. a mapped .dat file) instead of owning the hits; offsets are global
+	void setView(int* offsets, HitType* allHits, int fr, int to) {
+		assert(fr >= 0 && fr <= to);
+		s.clear();
+		hits.clear();
+
+		n = to - fr;
+		nhits = offsets[to] - offsets[fr];
+		sp = offsets + fr;
+		sbase = offsets[fr];
+		hitp = allHits + sbase;
+	}
 
 	void push_back(const HitType& hit)  {
 		hits.push_back(hit);
 		++nhits;
+		syncView();
 	}
 
 	//update read information vector etc
@@ -36,6 +47,7 @@ public:
 		if (nhits > s.back()) {  //Do not change if last read does not have hits
 			s.push_back(nhits);
 			++n;
+			syncView();
 		}
 	}
 
@@ -46,48 +58,30 @@ public:
 	int calcNumGeneMultiReads(const GroupInfo&);
 	int calcNumIsoformMultiReads();
 
-	int getSAt(int pos) { assert(pos >= 0 && pos <= n); return s[pos]; }
+	int getSAt(int pos) { assert(pos >= 0 && pos <= n); return sp[pos] - sbase; }
 
-	HitType& getHitAt(int pos) { assert(pos >= 0 && pos < nhits); return hits[pos]; }
+	HitType& getHitAt(int pos) { assert(pos >= 0 && pos < nhits); return hitp[pos]; }
 
 private:
 	int n; // n reads in total
 	int nhits; // # of hits
 	std::vector<int> s;
 	std::vector<HitType> hits;
-};
 
-//Each time only read one read's hits. If you want to start over, must call clear() first!
-template<class HitType>
-bool HitContainer<HitType>::read(std::istream& in) {
-	int tot;
-
-	if (!(in>>tot)) return false;
-	assert(tot > 0);
-	for (int i = 0; i < tot; i++) {
-		HitType hit;
-		if (!hit.read(in)) return false;
-		hits.push_back(hit);
-	}
+	// what getSAt/getHitAt read, either the vectors above or an external store
+	int *sp, sbase;
+	HitType *hitp;
 
-	nhits = nhits + tot;
-	++n;
-	s.push_back(nhits);
+	// a copy would point into the original's vectors or into a mapping it cannot keep alive
+	HitContainer(const HitContainer&);
+	HitContainer& operator=(const HitContainer&);
 
-	return true;
-}
-
-template<class HitType>
-void HitContainer<HitType>::write(std::ostream& out) {
-	if (n <= 0) return;
-	for (int i = 0; i < n; i++) {
-		out<<s[i + 1] - s[i];
-		for (int j = s[i]; j < s[i + 1]; j++) {
-			hits[j].write(out);
-		}
-		out<<std::endl;
+	void syncView() {
+		sp = &s[0];
+		sbase = 0;
+		hitp = (hits.empty() ? NULL : &hits[0]);
 	}
-}
+};
 
 template<class HitType>
 int HitContainer<HitType>::calcNumGeneMultiReads(const GroupInfo& gi) {
@@ -95,9 +89,9 @@ int HitContainer<HitType>::calcNumGeneMultiReads(const GroupInfo& gi) {
 	int *sortgids = NULL;
 
 	for (int i = 0; i < n; i++) {
-		int num = s[i + 1] - s[i];
+		int fr = getSAt(i), num = getSAt(i + 1) - fr;
 		sortgids = new int[num];
-		for (int j = s[i]; j < s[i + 1]; j++) sortgids[j] = gi.gidAt(hits[j].getSid());
+		for (int j = 0; j < num; j++) sortgids[j] = gi.gidAt(getHitAt(fr + j).getSid());
 		std::sort(sortgids, sortgids + num);
 		if (std::unique(sortgids, sortgids + num) - sortgids > 1) ++res;
 		delete[] sortgids;
@@ -110,7 +104,7 @@ template<class HitType>
 int HitContainer<HitType>::calcNumIsoformMultiReads() {
 	int res = 0;
 	for (int i = 0; i < n; i++)
-		if (s[i + 1] - s[i] > 1) ++res;
+		if (getSAt(i + 1) - getSAt(i) > 1) ++res;
 	return res;
 }
 
@@ -0,0 +1,231 @@
+#ifndef HITFILE_H_
+#define HITFILE_H_
+
+/**
+Binary hit file (.dat), written by rsem-parse-alignments and memory-mapped by rsem-run-em.
+
+Layout:
+  HitFileHeader
+  nHits hit records, stored exactly as HitType is laid out in memory (conprb = 0)
+  N + 1 read offsets (int), offsets[0] = 0 and offsets[N] = nHits; hits of read i are [offsets[i], offsets[i + 1])
+
+Hit records are kept in HitType's own layout so that HitContainer can point into the mapping directly.
+The header records sizeof(HitType), a file written by a build with a different layout is rejected.
+ */
+
+#include<cstdio>
+#include<cstring>
+#include<cstdlib>
+#include<cassert>
+#include<vector>
+#include<new>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+#include "utils.h"
+#include "my_assert.h"
+#include "SingleHit.h"
+#include "PairedEndHit.h"
+#include "HitContainer.h"
+#include "AsyncWriter.h"
+
+const char HITFILE_MAGIC[8] = "RSEMHIT";
+const int HITFILE_VERSION = 1;
+
+// builds the record of hit in zeroed storage from its fields, so that padding bytes stay 0; conprb is not stored
+inline void buildHitRecord(void* record, const SingleHit& hit) {
+	new (record) SingleHit(hit.getDir() ? -hit.getSid() : hit.getSid(), hit.getPos());
+}
+
+inline void buildHitRecord(void* record, const PairedEndHit& hit) {
+	new (record) PairedEndHit(hit.getDir() ? -hit.getSid() : hit.getSid(), hit.getPos(), hit.getInsertL());
+}
+
+struct HitFileHeader {
+	char magic[8];
+	int version;
+	int read_type;
+	int hitSize; // sizeof(HitType) used by the writer
+	int N; // number of alignable reads
+	int nHits; // number of hits
+	int reserved;
+	long long offsetsPos; // byte position of the offsets array
+
+	HitFileHeader() {
+		memset(this, 0, sizeof(HitFileHeader));
+	}
+};
+
+template<class HitType>
+class HitFileWriter {
+public:
+	// writer, if not NULL, writes the hits (on its thread, if it has one)
+	HitFileWriter(const char*, int, AsyncWriter* writer = NULL);
+	~HitFileWriter() { if (fo != NULL) close(); }
+
+	void write(HitContainer<HitType>&); // append all reads in the container
+	void close(); // write offsets and header
+
+	int getN() const { return header.N; }
+	int getNHits() const { return header.nHits; }
+
+private:
+	FILE *fo;
+	AsyncWriter *writer;
+	AsyncFileBuf *buf; // hits and offsets go through buf if there is a writer
+	HitFileHeader header;
+	std::vector<int> offsets;
+	union {
+		char bytes[sizeof(HitType)];
+		double align; // hits hold a double
+	} record;
+
+	void put(const void* data, size_t size, size_t count, const char* errmsg) {
+		if (buf != NULL) buf->sputn((const char*)data, size * count);
+		else general_assert(fwrite(data, size, count, fo) == count, errmsg);
+	}
+};
+
+template<class HitType>
+HitFileWriter<HitType>::HitFileWriter(const char* datF, int read_type, AsyncWriter* writer) {
+	fo = fopen(datF, "wb");
+	general_assert(fo != NULL, "Cannot create " + cstrtos(datF) + "!");
+	this->writer = writer;
+	buf = NULL;
+
+	memcpy(header.magic, HITFILE_MAGIC, sizeof(HITFILE_MAGIC));
+	header.version = HITFILE_VERSION;
+	header.read_type = read_type;
+	header.hitSize = sizeof(HitType);
+
+	// header is written again when closing
+	general_assert(fwrite(&header, sizeof(HitFileHeader), 1, fo) == 1, "Fail to write hit file header!");
+	if (writer != NULL) buf = new AsyncFileBuf(writer, fo, false);
+
+	offsets.clear();
+	offsets.push_back(0);
+}
+
+template<class HitType>
+void HitFileWriter<HitType>::write(HitContainer<HitType>& hits) {
+	int n = hits.getN();
+
+	for (int i = 0; i < n; i++) {
+		int fr = hits.getSAt(i), to = hits.getSAt(i + 1);
+		for (int j = fr; j < to; j++) {
+			memset(record.bytes, 0, sizeof(HitType));
+			buildHitRecord(record.bytes, hits.getHitAt(j));
+			put(record.bytes, sizeof(HitType), 1, "Fail to write hits!");
+		}
+		header.nHits += to - fr;
+		++header.N;
+		offsets.push_back(header.nHits);
+	}
+}
+
+template<class HitType>
+void HitFileWriter<HitType>::close() {
+	header.offsetsPos = sizeof(HitFileHeader) + (long long)header.nHits * sizeof(HitType);
+	put(&offsets[0], sizeof(int), offsets.size(), "Fail to write hit offsets!");
+	if (buf != NULL) {
+		// the header is written directly, after everything else has reached the file
+		buf->close();
+		writer->flush();
+		delete buf;
+		buf = NULL;
+	}
+
+	fseek(fo, 0, SEEK_SET);
+	general_assert(fwrite(&header, sizeof(HitFileHeader), 1, fo) == 1, "Fail to write hit file header!");
+
+	fclose(fo);
+	fo = NULL;
+	offsets.clear();
+}
+
+// Read-only view of a .dat file. Pages are mapped privately, so hits can be modified in memory (e.g. setConPrb) without touching the file.
+class HitFile {
+public:
+	HitFile() { base = NULL; length = 0; }
+	~HitFile() { unmap(); }
+
+	void map(const char*, int);
+	void unmap();
+
+	// the header of a .dat file, without mapping the file
+	static HitFileHeader readHeader(const char*);
+
+	int getN() const { return header.N; }
+	int getNHits() const { return header.nHits; }
+	int getReadType() const { return header.read_type; }
+	long long getFileSize() const { return length; }
+
+	int* getOffsets() { assert(base != NULL); return (int*)(base + header.offsetsPos); }
+	void* getHits() { assert(base != NULL); return (void*)(base + sizeof(HitFileHeader)); }
+
+	// Gives the pages holding hit records back to the system, including the private copies made by setConPrb.
+	// Hits stay readable, but read as in the file afterwards (conprb = 0). Returns the number of bytes released.
+	long long releaseHits() { assert(base != NULL); return releaseHits(getHits(), base + header.offsetsPos); }
+	// the same for the hits in [fr, to), only pages lying entirely within the range are released
+	long long releaseHits(const void* fr, const void* to);
+
+private:
+	char *base;
+	size_t length;
+	HitFileHeader header;
+};
+
+// hitSize : sizeof(HitType) expected by the caller
+void HitFile::map(const char* datF, int hitSize) {
+	int fd;
+	struct stat st;
+
+	fd = open(datF, O_RDONLY);
+	general_assert(fd >= 0, "Cannot open " + cstrtos(datF) + "! It may not exist.");
+	general_assert(fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(HitFileHeader), cstrtos(datF) + " is not a valid hit file!");
+
+	length = st.st_size;
+	void *addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	general_assert(addr != MAP_FAILED, "Cannot map " + cstrtos(datF) + " into memory!");
+	close(fd);
+
+	base = (char*)addr;
+	memcpy(&header, base, sizeof(HitFileHeader));
+
+	general_assert(!memcmp(header.magic, HITFILE_MAGIC, sizeof(HITFILE_MAGIC)), cstrtos(datF) + " is not a binary hit file! Please rerun rsem-parse-alignments.");
+	general_assert(header.version == HITFILE_VERSION, "Hit file " + cstrtos(datF) + " has version " + itos(header.version) + " while version " + itos(HITFILE_VERSION) + " is expected!");
+	general_assert(header.hitSize == hitSize, "Hit records in " + cstrtos(datF) + " do not match this build of RSEM!");
+	general_assert(header.offsetsPos == (long long)sizeof(HitFileHeader) + (long long)header.nHits * hitSize &&
+		       header.offsetsPos + (long long)(header.N + 1) * (long long)sizeof(int) <= (long long)length, cstrtos(datF) + " is truncated!");
+}
+
+HitFileHeader HitFile::readHeader(const char* datF) {
+	HitFileHeader header;
+	FILE *fi = fopen(datF, "rb");
+
+	general_assert(fi != NULL, "Cannot open " + cstrtos(datF) + "! It may not exist.");
+	general_assert(fread(&header, sizeof(HitFileHeader), 1, fi) == 1 && !memcmp(header.magic, HITFILE_MAGIC, sizeof(HITFILE_MAGIC)), cstrtos(datF) + " is not a binary hit file! Please rerun rsem-parse-alignments.");
+	fclose(fi);
+
+	return header;
+}
+
+long long HitFile::releaseHits(const void* fr, const void* to) {
+	assert(base != NULL && (const char*)fr >= (const char*)getHits() && (const char*)to <= base + header.offsetsPos);
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t pfr = ((const char*)fr - base + pageSize - 1) / pageSize * pageSize; // pages shared with the header, the offsets or other hits are kept
+	size_t pto = ((const char*)to - base) / pageSize * pageSize;
+	if (pfr >= pto) return 0;
+	general_assert(madvise(base + pfr, pto - pfr, MADV_DONTNEED) == 0, "Cannot release the pages of hits!");
+	return pto - pfr;
+}
+
+void HitFile::unmap() {
+	if (base == NULL) return;
+	munmap(base, length);
+	base = NULL; length = 0;
+}
+
+#endif /* HITFILE_H_ */
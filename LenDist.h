@@ -5,6 +5,7 @@
 #include<cstring>
 #include<cstdlib>
 #include<cassert>
+#include<vector>
 #include<algorithm>
 
 #include "boost/math/distributions/normal.hpp"
@@ -29,6 +30,7 @@ public:
 			pdf[i] = 1.0 / span;
 			cdf[i] = i * 1.0 / span;
 		}
+		calcNorms();
 	}
 
 	~LenDist() {
@@ -62,23 +64,32 @@ public:
 	//refL : reference sequence length, in fact, this is totLen for global length distribution
 	double getAdjustedProb(int len, int refL) const {
 		if (len <= lb || len > ub || refL <= lb) return 0.0;
-		double denom = cdf[std::min(ub, refL) - lb];
-		assert(denom >= EPSILON);
-		return pdf[len - lb] / denom;
+		double norm = norms[std::min(ub, refL) - lb];
+		assert(norm > 0.0);
+		return pdf[len - lb] * norm;
+	}
+
+	//denominator of getAdjustedProb(len, refL), 0 if no length fits into refL
+	double getAdjustedDenom(int refL) const {
+		return (refL <= lb ? 0.0 : cdf[std::min(ub, refL) - lb]);
 	}
 
 	//len : length threshold, any length <= len should be calculated
 	//refL : reference sequence length
 	double getAdjustedCumulativeProb(int len, int refL) const {
 		assert(len > lb && len <= ub && refL > lb);
-		double denom = cdf[std::min(ub, refL) - lb];
-		assert(denom >= EPSILON);
-		return cdf[len - lb] / denom;
+		double norm = norms[std::min(ub, refL) - lb];
+		assert(norm > 0.0);
+		return cdf[len - lb] * norm;
 	}
 
 	//for multi-thread usage
 	void collect(const LenDist&);
 
+	// what collect() adds up, as a flat array for adding up across processes; both return the number of doubles
+	int packStats(double* buf) const; // only counts if buf is NULL
+	int collectStats(const double* buf); // adds buf in, like collect()
+
 	void read(FILE*);
 	void write(FILE*);
 
@@ -89,8 +100,12 @@ public:
  private:
 	int lb, ub, span; // (lb, ub]
 	double *pdf, *cdf;
+	// norms[i] = 1 / cdf[i], 0 if cdf[i] < EPSILON; the adjusted probabilities only multiply by it. Rebuilt
+	// wherever cdf is finalized (construction, setAsNormal, finish, read), stale between init() and finish() like cdf
+	std::vector<double> norms;
 
 	void trim();
+	void calcNorms();
 };
 
 LenDist& LenDist::operator=(const LenDist& rv) {
@@ -104,6 +119,7 @@ LenDist& LenDist::operator=(const LenDist& rv) {
 	lb = rv.lb; ub = rv.ub; span = rv.span;
 	memcpy(pdf, rv.pdf, sizeof(double) * (span + 1));
 	memcpy(cdf, rv.cdf, sizeof(double) * (span + 1));
+	norms = rv.norms;
 
 	return *this;
 }
@@ -126,6 +142,7 @@ void LenDist::setAsNormal(double mean, double sd, int minL, int maxL) {
     cdf = new double[span + 1];
     pdf[0] = cdf[0] = 0.0;
     pdf[1] = cdf[1] = 1.0;
+    calcNorms();
 
     return;
   }
@@ -176,6 +193,7 @@ void LenDist::setAsNormal(double mean, double sd, int minL, int maxL) {
   }
   
   trim();
+  calcNorms();
 }
 
 void LenDist::init() {
@@ -197,6 +215,7 @@ void LenDist::finish() {
 		cdf[i] = cdf[i - 1] + pdf[i];
 	}
 	trim();
+	calcNorms();
 }
 
 
@@ -215,6 +234,16 @@ void LenDist::collect(const LenDist& o) {
 	}
 }
 
+int LenDist::packStats(double* buf) const {
+	if (buf != NULL) memcpy(buf, pdf + 1, sizeof(double) * span);
+	return span;
+}
+
+int LenDist::collectStats(const double* buf) {
+	for (int i = 1; i <= span; i++) pdf[i] += buf[i - 1];
+	return span;
+}
+
 void LenDist::read(FILE *fi) {
 	//release default space first
 	delete[] pdf;
@@ -230,6 +259,7 @@ void LenDist::read(FILE *fi) {
 	}
 
 	trim();
+	calcNorms();
 }
 
 void LenDist::write(FILE *fo) {
@@ -293,4 +323,10 @@ void LenDist::trim() {
   ub = lb + span;
 }
 
+void LenDist::calcNorms() {
+	norms.assign(span + 1, 0.0);
+	for (int i = 1; i <= span; i++)
+		if (cdf[i] >= EPSILON) norms[i] = 1.0 / cdf[i];
+}
+
 #endif /* LENDIST_H_ */
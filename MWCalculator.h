@@ -0,0 +1,176 @@
+#ifndef MWCALCULATOR_H_
+#define MWCALCULATOR_H_
+
+/**
+Mappability weights (mw) of the models: mw[i] is 1 minus the probability that a read from transcript i has its
+seed in a masked region. The models used to sum over every masked seed position and every fragment length.
+
+Per transcript, every term is gld(fragLen | totLen) / rspd denominator(effL) times the RSPD probability of the
+fragment start. So the prefix sums over fragLen of
+
+  w(fragLen) = gld(fragLen | totLen) / rspd denominator(effL)
+
+are built once per transcript. A forward seed starts its fragment at the seed, and its sum over fragment lengths
+is one prefix sum. A reverse seed moves the fragment start with fragLen, and its sum is taken run by run over
+the RSPD bins, see RSPD::visitPosRuns, in O(B) per masked position, or O(1) if the RSPD is uniform.
+
+The mld factor of the single-end models, mld->getAdjustedCumulativeProb(min(mld maxL, fragLen), fragLen), is
+cdf[x] / cdf[x] for one x and thus 1, so it is left out.
+
+Transcripts are independent; with a worker pool they are handed out to the workers in blocks.
+ */
+
+#include<cassert>
+#include<vector>
+#include<algorithm>
+
+#include "utils.h"
+#include "LenDist.h"
+#include "RSPD.h"
+#include "RefSeq.h"
+#include "Refs.h"
+#include "WorkerPool.h"
+
+class MWCalculator {
+public:
+	// pairedEnd : seeds are fragment starts and are only counted in the forward direction, probF and probR unused
+	MWCalculator(Refs* refs, const LenDist* gld, const RSPD* rspd, int seedLen, bool pairedEnd, double probF = 1.0, double probR = 0.0)
+		: refs(refs), gld(gld), rspd(rspd), seedLen(seedLen), pairedEnd(pairedEnd), probF(pairedEnd ? 1.0 : probF), probR(pairedEnd ? 0.0 : probR) {}
+
+	// fills mw[0 .. M], on the threads of pool if it is not NULL
+	void calc(double* mw, WorkerPool* pool = NULL);
+
+private:
+	static const int BLOCK_SIZE = 256; // transcripts handed out at a time
+
+	struct Worker {
+		MWCalculator *calc;
+		std::vector<double> prefix; // scratch, prefix sums of w for the current transcript
+	};
+
+	// sum of w * RSPD probability over fragLen in [minL, maxL] for a reverse seed with k = seedPos + seedLen
+	struct ReverseSum {
+		const double *prefix;
+		int gminL, k;
+		double sum;
+		ReverseSum(const double* prefix, int gminL, int k) : prefix(prefix), gminL(gminL), k(k), sum(0.0) {}
+		void operator() (int fr, int to, double posProb) { sum += posProb * (prefix[k - fr - gminL + 1] - prefix[k - to - gminL]); }
+	};
+
+	Refs *refs;
+	const LenDist *gld;
+	const RSPD *rspd;
+	int seedLen;
+	bool pairedEnd;
+	double probF, probR;
+
+	double *mw;
+	int nextBlock;
+
+	void buildPrefix(int totLen, int fullLen, int maxL, std::vector<double>& prefix) const;
+	double calcOne(int sid, std::vector<double>& prefix) const;
+	double reverseSum(const double* prefix, int fullLen, int seedPos, int minL, int maxL) const;
+
+	static void* calcTask(void* arg);
+};
+
+void MWCalculator::calc(double* mw, WorkerPool* pool) {
+	this->mw = mw;
+	mw[0] = 1.0;
+	nextBlock = 0;
+
+	if (pool == NULL) {
+		Worker worker;
+		worker.calc = this;
+		calcTask(&worker);
+		return;
+	}
+
+	int nThreads = pool->getNThreads();
+	std::vector<Worker> workers(nThreads);
+	std::vector<void*> args(nThreads);
+	for (int i = 0; i < nThreads; i++) {
+		workers[i].calc = this;
+		args[i] = (void*)&workers[i];
+	}
+	pool->run(calcTask, &args[0]);
+}
+
+void* MWCalculator::calcTask(void* arg) {
+	Worker *worker = (Worker*)arg;
+	MWCalculator *calc = worker->calc;
+	int M = calc->refs->getM(), b;
+
+	while ((b = __sync_fetch_and_add(&calc->nextBlock, 1)) * BLOCK_SIZE < M) {
+		int to = std::min(M, (b + 1) * BLOCK_SIZE);
+		for (int i = b * BLOCK_SIZE + 1; i <= to; i++) {
+			double value = 1.0 - calc->calcOne(i, worker->prefix);
+			calc->mw[i] = (value < 1e-8 ? 0.0 : value);
+		}
+	}
+
+	return NULL;
+}
+
+// prefix[fragLen - gminL + 1] : sum of w over [gminL, fragLen], for fragLen up to maxL
+void MWCalculator::buildPrefix(int totLen, int fullLen, int maxL, std::vector<double>& prefix) const {
+	int gminL = gld->getMinL();
+	long double sum = 0.0; // long double, so that differences of two prefix sums stay accurate
+
+	prefix.resize(maxL - gminL + 2);
+	prefix[0] = 0.0;
+	for (int fragLen = gminL; fragLen <= maxL; fragLen++) {
+		int effL = std::min(fullLen, totLen - fragLen + 1);
+		double denom = rspd->getAdjustedDenom(effL, fullLen);
+		if (denom >= EPSILON) sum += gld->getAdjustedProb(fragLen, totLen) / denom;
+		prefix[fragLen - gminL + 1] = (double)sum;
+	}
+}
+
+double MWCalculator::reverseSum(const double* prefix, int fullLen, int seedPos, int minL, int maxL) const {
+	int k = seedPos + seedLen;
+	ReverseSum sum(prefix, gld->getMinL(), k);
+	rspd->visitPosRuns(k - maxL, k - minL, fullLen, sum);
+	return sum.sum;
+}
+
+// probability of a masked seed in transcript sid
+double MWCalculator::calcOne(int sid, std::vector<double>& prefix) const {
+	RefSeq& ref = refs->getRef(sid);
+	int totLen = ref.getTotLen();
+	int fullLen = ref.getFullLen();
+	int gminL = gld->getMinL(), gmaxL = std::min(gld->getMaxL(), totLen);
+	int end = std::min(fullLen, totLen - (pairedEnd ? gminL : seedLen) + 1);
+	int minL, maxL;
+	bool built = false;
+	double value = 0.0;
+
+	if (gmaxL < gminL) return 0.0; // no fragment fits into the transcript
+
+	for (int seedPos = 0; seedPos < end; seedPos++)
+		if (ref.getMask(seedPos)) {
+			if (!built) { buildPrefix(totLen, fullLen, gmaxL, prefix); built = true; }
+			//forward
+			maxL = std::min(gmaxL, totLen - seedPos);
+			if (maxL >= gminL) value += probF * rspd->getPosProb(seedPos, fullLen) * prefix[maxL - gminL + 1];
+			//reverse
+			if (pairedEnd) continue;
+			maxL = std::min(gmaxL, seedPos + seedLen);
+			if (maxL >= gminL) value += probR * reverseSum(&prefix[0], fullLen, seedPos, gminL, maxL);
+		}
+
+	if (pairedEnd) return value;
+
+	//for reverse strand masking
+	for (int seedPos = end; seedPos <= totLen - seedLen; seedPos++) {
+		minL = std::max(gminL, seedPos + seedLen - fullLen + 1);
+		maxL = std::min(gmaxL, seedPos + seedLen);
+		if (minL > maxL) continue;
+		if (!built) { buildPrefix(totLen, fullLen, gmaxL, prefix); built = true; }
+		value += probR * reverseSum(&prefix[0], fullLen, seedPos, minL, maxL);
+	}
+
+	return value;
+}
+
+#endif /* MWCALCULATOR_H_ */
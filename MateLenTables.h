@@ -0,0 +1,194 @@
+#ifndef MATELENTABLES_H_
+#define MATELENTABLES_H_
+
+/**
+Tables for the sum over fragment lengths which single-end models do for every hit when a mate length
+distribution (mld) is given:
+
+  sum over fragLen in [minL, maxL] of gld(fragLen | totLen) * rspd(pfpos | effL) * mld(readLen | fragLen)
+
+Apart from pfpos, every factor depends on the transcript only through its lengths, and mld(readLen | fragLen)
+splits into mld(readLen) / denominator(fragLen). So for each distinct (fullLen, totLen) pair the tables keep
+prefix sums over fragLen of
+
+  w(fragLen) = gld(fragLen | totLen) / rspd denominator(effL) / mld denominator(fragLen)
+
+For the forward strand pfpos = pos is the same for all fragment lengths, and the sum is one difference of prefix
+sums. For the reverse strand pfpos = totLen - pos - fragLen moves with fragLen. If the RSPD is uniform the
+position term is constant. Otherwise it is constant while pfpos stays inside one RSPD bin, so the sum is taken
+bin by bin, in O(B) per hit. Only the positions which straddle two bins are done one by one.
+
+The tables are a snapshot: build() copies gld, mld and rspd. They must be rebuilt whenever those change.
+ */
+
+#include<cassert>
+#include<vector>
+#include<map>
+#include<utility>
+#include<algorithm>
+
+#include "utils.h"
+#include "my_assert.h"
+#include "LenDist.h"
+#include "RSPD.h"
+#include "RefSeq.h"
+#include "Refs.h"
+
+class MateLenTables {
+public:
+	MateLenTables() : mld(NULL), rspd(NULL) {}
+	~MateLenTables() { clear(); }
+
+	void build(const LenDist* gld, const LenDist* mld, const RSPD* rspd, Refs* refs);
+
+	bool isBuilt() const { return mld != NULL; }
+
+	// the sum for a read of length readLen aligned at pos of transcript sid, dir and pos as in SingleHit
+	double getSum(int sid, int fullLen, int totLen, int dir, int pos, int readLen) const;
+
+	// adds frac to target, spread over the fragment start positions of a reverse strand hit, weighted by their terms
+	void updateRSPD(RSPD* target, int sid, int fullLen, int totLen, int pos, int readLen, double frac) const;
+
+private:
+	struct SumVisitor {
+		double sum;
+		SumVisitor() : sum(0.0) {}
+		void operator() (int pfpos, double value) { sum += value; }
+	};
+
+	struct UpdateVisitor {
+		RSPD *target;
+		int fullLen;
+		double scale;
+		UpdateVisitor(RSPD* target, int fullLen, double scale) : target(target), fullLen(fullLen), scale(scale) {}
+		void operator() (int pfpos, double value) { target->update(pfpos, fullLen, value * scale); }
+	};
+
+	int gminL, gmaxL; // fragment lengths of gld
+	LenDist *mld;
+	RSPD *rspd;
+
+	std::vector<int> tableOf; // tableOf[sid], -1 if no fragment fits into the transcript
+	std::vector<size_t> starts; // prefix[starts[t] + fragLen - gminL + 1] : sum of w over [gminL, fragLen] in table t
+	std::vector<double> prefix;
+
+	void clear();
+
+	// sum of w over [fr, to] in table t
+	double range(int t, int fr, int to) const {
+		const double *p = &prefix[starts[t]];
+		return p[to - gminL + 1] - p[fr - gminL];
+	}
+
+	bool getRange(int sid, int totLen, int pos, int readLen, int& minL, int& maxL, double& mldProb) const;
+
+	// turns the runs of RSPD::visitPosRuns into summed terms of a reverse strand hit, k = totLen - pos
+	template<class Visitor>
+	struct ReverseRuns {
+		const MateLenTables *tables;
+		int t, k;
+		Visitor &visitor;
+		ReverseRuns(const MateLenTables* tables, int t, int k, Visitor& visitor) : tables(tables), t(t), k(k), visitor(visitor) {}
+		void operator() (int fr, int to, double posProb) { visitor(fr, posProb * tables->range(t, k - to, k - fr)); }
+	};
+
+	template<class Visitor>
+	void visitReverse(int t, int fullLen, int totLen, int pos, int minL, int maxL, Visitor& visitor) const;
+};
+
+void MateLenTables::clear() {
+	if (mld != NULL) { delete mld; mld = NULL; }
+	if (rspd != NULL) { delete rspd; rspd = NULL; }
+	tableOf.clear(); starts.clear(); prefix.clear();
+}
+
+void MateLenTables::build(const LenDist* gld, const LenDist* mld, const RSPD* rspd, Refs* refs) {
+	std::map<std::pair<int, int>, int> tableOfLens;
+	int M = refs->getM();
+
+	clear();
+	this->mld = new LenDist();
+	*(this->mld) = *mld;
+	this->rspd = new RSPD(rspd->isEstimated(), rspd->getB());
+	*(this->rspd) = *rspd;
+
+	gminL = gld->getMinL();
+	gmaxL = gld->getMaxL();
+	tableOf.assign(M + 1, -1);
+
+	for (int i = 1; i <= M; i++) {
+		RefSeq &ref = refs->getRef(i);
+		int fullLen = ref.getFullLen(), totLen = ref.getTotLen();
+		int maxL = std::min(gmaxL, totLen);
+		if (maxL < gminL) continue;
+
+		std::pair<int, int> lens(fullLen, totLen);
+		std::map<std::pair<int, int>, int>::iterator iter = tableOfLens.find(lens);
+		if (iter != tableOfLens.end()) { tableOf[i] = iter->second; continue; }
+
+		int t = starts.size();
+		tableOfLens[lens] = tableOf[i] = t;
+		starts.push_back(prefix.size());
+
+		long double sum = 0.0; // long double, so that differences of two prefix sums stay accurate
+		prefix.push_back(0.0);
+		for (int fragLen = gminL; fragLen <= maxL; fragLen++) {
+			int effL = std::min(fullLen, totLen - fragLen + 1);
+			double rdenom = rspd->getAdjustedDenom(effL, fullLen);
+			double mdenom = mld->getAdjustedDenom(fragLen);
+			if (rdenom >= EPSILON && mdenom >= EPSILON) sum += gld->getAdjustedProb(fragLen, totLen) / rdenom / mdenom;
+			prefix.push_back((double)sum);
+		}
+	}
+}
+
+// the fragment lengths a hit can come from, as in the loop this replaces; false if the sum is 0
+bool MateLenTables::getRange(int sid, int totLen, int pos, int readLen, int& minL, int& maxL, double& mldProb) const {
+	if (tableOf[sid] < 0 || readLen < mld->getMinL() || readLen > mld->getMaxL()) return false;
+	minL = std::max(readLen, gminL);
+	maxL = std::min(totLen - pos, gmaxL);
+	mldProb = mld->getProb(readLen);
+	return minL <= maxL;
+}
+
+/*
+  Visits the terms of a reverse strand hit, pfpos = totLen - pos - fragLen. visitor(pfpos, value) gets the summed
+  terms of a run of positions sharing one RSPD probability, with the first position of the run.
+*/
+template<class Visitor>
+void MateLenTables::visitReverse(int t, int fullLen, int totLen, int pos, int minL, int maxL, Visitor& visitor) const {
+	int k = totLen - pos;
+	ReverseRuns<Visitor> runs(this, t, k, visitor);
+	rspd->visitPosRuns(k - maxL, k - minL, fullLen, runs);
+}
+
+double MateLenTables::getSum(int sid, int fullLen, int totLen, int dir, int pos, int readLen) const {
+	int minL, maxL, t = tableOf[sid];
+	double mldProb;
+
+	assert(isBuilt());
+	if (!getRange(sid, totLen, pos, readLen, minL, maxL, mldProb)) return 0.0;
+
+	if (dir == 0) return mldProb * rspd->getPosProb(pos, fullLen) * range(t, minL, maxL);
+
+	SumVisitor visitor;
+	visitReverse(t, fullLen, totLen, pos, minL, maxL, visitor);
+	return mldProb * visitor.sum;
+}
+
+void MateLenTables::updateRSPD(RSPD* target, int sid, int fullLen, int totLen, int pos, int readLen, double frac) const {
+	int minL, maxL, t = tableOf[sid];
+	double mldProb;
+
+	assert(isBuilt() && rspd->isEstimated());
+	general_assert(getRange(sid, totLen, pos, readLen, minL, maxL, mldProb), "No fragment length fits a hit used for RSPD estimation!");
+
+	SumVisitor sum;
+	visitReverse(t, fullLen, totLen, pos, minL, maxL, sum);
+	assert(sum.sum >= EPSILON);
+
+	UpdateVisitor update(target, fullLen, frac / sum.sum);
+	visitReverse(t, fullLen, totLen, pos, minL, maxL, update);
+}
+
+#endif /* MATELENTABLES_H_ */
@@ -8,6 +8,7 @@
 #include<cassert>
 
 #include "utils.h"
+#include "Emission.h"
 #include "RefSeq.h"
 #include "simul.h"
 
@@ -32,6 +33,10 @@ public:
 
 	void collect(const NoiseProfile&);
 
+	// what collect() adds up, as a flat array for adding up across processes; both return the number of doubles
+	int packStats(double* buf) const; // only counts if buf is NULL
+	int collectStats(const double* buf); // adds buf in, like collect()
+
 	void read(FILE*);
 	void write(FILE*);
 
@@ -69,10 +74,7 @@ void NoiseProfile::updateC(const std::string& readseq) {
 }
 
 void NoiseProfile::update(const std::string& readseq, double frac) {
-	int len = readseq.size();
-	for (int i = 0; i < len; i++) {
-		p[get_base_id(readseq[i])] += frac;
-	}
+	emissionUpdate(p, readseq.c_str(), NULL, NULL, 0, 0, 0, readseq.size(), frac);
 }
 
 void NoiseProfile::finish() {
@@ -101,14 +103,7 @@ void NoiseProfile::calcInitParams() {
 }
 
 double NoiseProfile::getProb(const std::string& readseq) {
-	double prob = 1.0;
-	int len = readseq.size();
-
-	for (int i = 0; i < len; i++) {
-		prob *= p[get_base_id(readseq[i])];
-	}
-
-	return prob;
+	return emissionProb(p, readseq.c_str(), NULL, NULL, 0, 0, 0, readseq.size());
 }
 
 void NoiseProfile::collect(const NoiseProfile& o) {
@@ -116,6 +111,16 @@ void NoiseProfile::collect(const NoiseProfile& o) {
 		p[i] += o.p[i];
 }
 
+int NoiseProfile::packStats(double* buf) const {
+	if (buf != NULL) memcpy(buf, p, sizeof(double) * NCODES);
+	return NCODES;
+}
+
+int NoiseProfile::collectStats(const double* buf) {
+	for (int i = 0; i < NCODES; i++) p[i] += buf[i];
+	return NCODES;
+}
+
 void NoiseProfile::read(FILE *fi) {
 	int tmp_ncodes;
 
@@ -8,6 +8,7 @@
 #include<cassert>
 
 #include "utils.h"
+#include "Emission.h"
 #include "RefSeq.h"
 #include "simul.h"
 
@@ -32,6 +33,10 @@ public:
 
 	void collect(const NoiseQProfile&);
 
+	// what collect() adds up, as a flat array for adding up across processes; both return the number of doubles
+	int packStats(double* buf) const; // only counts if buf is NULL
+	int collectStats(const double* buf); // adds buf in, like collect()
+
 	void read(FILE*);
 	void write(FILE*);
 
@@ -72,10 +77,7 @@ void NoiseQProfile::updateC(const std::string& readseq, const std::string& qual)
 }
 
 void NoiseQProfile::update(const std::string& readseq, const std::string& qual, double frac) {
-	int len = readseq.size();
-	for (int i = 0; i < len; i++) {
-		p[c2q(qual[i])][get_base_id(readseq[i])] += frac;
-	}
+	emissionUpdate(&p[0][0], readseq.c_str(), qual.c_str(), NULL, 0, NCODES, 0, readseq.size(), frac);
 }
 
 void NoiseQProfile::finish() {
@@ -111,14 +113,7 @@ void NoiseQProfile::calcInitParams() {
 }
 
 double NoiseQProfile::getProb(const std::string& readseq, const std::string& qual) {
-	double prob = 1.0;
-	int len = readseq.size();
-
-	for (int i = 0; i < len; i++) {
-		prob *= p[c2q(qual[i])][get_base_id(readseq[i])];
-	}
-
-	return prob;
+	return emissionProb(&p[0][0], readseq.c_str(), qual.c_str(), NULL, 0, NCODES, 0, readseq.size());
 }
 
 void NoiseQProfile::collect(const NoiseQProfile& o) {
@@ -128,6 +123,19 @@ void NoiseQProfile::collect(const NoiseQProfile& o) {
 	}
 }
 
+int NoiseQProfile::packStats(double* buf) const {
+	int size = SIZE * NCODES;
+	if (buf != NULL) memcpy(buf, p, sizeof(double) * size);
+	return size;
+}
+
+int NoiseQProfile::collectStats(const double* buf) {
+	int size = SIZE * NCODES;
+	double *q = &p[0][0];
+	for (int i = 0; i < size; i++) q[i] += buf[i];
+	return size;
+}
+
 //If read from file, assume do not need to estimate from data
 void NoiseQProfile::read(FILE *fi) {
 	int tmp_size, tmp_ncodes;
@@ -0,0 +1,135 @@
+#ifndef OFGFILE_H_
+#define OFGFILE_H_
+
+/**
+Binary input of the Gibbs sampler (.ofg), written by rsem-run-em and memory-mapped by rsem-run-gibbs.
+
+Layout (compressed sparse rows, one row per read that has an entry):
+  OfgFileHeader
+  N + 1 row offsets (int), offsets[0] = 0 and offsets[N] = nEntries; entries of read i are [offsets[i], offsets[i + 1])
+  nEntries transcript ids (int), 0 is the noise transcript
+  4 bytes of padding if needed, so that the next array starts at a multiple of 8 bytes
+  nEntries conditional probabilities (double)
+
+Only entries with a conditional probability of at least EPSILON are kept, and reads without any such entry
+are left out. The sizes are known before anything is written, so the writer maps the whole file and
+threads fill disjoint parts of it.
+ */
+
+#include<cstdio>
+#include<cstring>
+#include<cstdlib>
+#include<cassert>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+#include "utils.h"
+#include "my_assert.h"
+
+const char OFGFILE_MAGIC[8] = "RSEMOFG";
+const int OFGFILE_VERSION = 2;
+
+struct OfgFileHeader {
+	char magic[8];
+	int version;
+	int M; // number of transcripts
+	int N0; // number of unalignable reads
+	int N; // number of reads in the file
+	int nEntries;
+	int reserved;
+
+	OfgFileHeader() {
+		memset(this, 0, sizeof(OfgFileHeader));
+	}
+
+	// byte position of the conditional probabilities, the int arrays before them are padded to a multiple of 8 bytes
+	static long long getConPrbsPos(int N, int nEntries) {
+		long long nInts = (long long)(N + 1) + nEntries;
+		return (long long)sizeof(OfgFileHeader) + (nInts + (nInts & 1)) * sizeof(int);
+	}
+
+	static long long getSize(int N, int nEntries) {
+		return getConPrbsPos(N, nEntries) + (long long)nEntries * sizeof(double);
+	}
+};
+
+// maps a .ofg file of known size, read and entry arrays are filled by the caller, possibly from several threads
+class OfgFile {
+public:
+	OfgFile() { base = NULL; length = 0; }
+	~OfgFile() { unmap(); }
+
+	void create(const char* ofgF, int M, int N0, int N, int nEntries);
+	void map(const char* ofgF, bool writable = false); // writable : fill in parts of a file another process created
+	void unmap();
+
+	int getM() const { return header.M; }
+	int getN0() const { return header.N0; }
+	int getN() const { return header.N; }
+	int getNEntries() const { return header.nEntries; }
+	long long getFileSize() const { return length; }
+
+	int* getOffsets() { assert(base != NULL); return (int*)(base + sizeof(OfgFileHeader)); }
+	int* getSids() { return getOffsets() + header.N + 1; }
+	double* getConPrbs() { assert(base != NULL); return (double*)(base + OfgFileHeader::getConPrbsPos(header.N, header.nEntries)); }
+
+private:
+	char *base;
+	size_t length;
+	OfgFileHeader header;
+};
+
+void OfgFile::create(const char* ofgF, int M, int N0, int N, int nEntries) {
+	int fd;
+
+	unmap();
+	memcpy(header.magic, OFGFILE_MAGIC, sizeof(OFGFILE_MAGIC));
+	header.version = OFGFILE_VERSION;
+	header.M = M; header.N0 = N0;
+	header.N = N; header.nEntries = nEntries;
+	length = OfgFileHeader::getSize(N, nEntries);
+
+	fd = open(ofgF, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	general_assert(fd >= 0, "Cannot create " + cstrtos(ofgF) + "!");
+	// allocate the blocks now, a full disk would otherwise show up as a crash while filling the mapping
+	general_assert(length == 0 || posix_fallocate(fd, 0, length) == 0, "Cannot create " + cstrtos(ofgF) + ", the disk may be full!");
+	void *addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	general_assert(addr != MAP_FAILED, "Cannot map " + cstrtos(ofgF) + " into memory!");
+	close(fd);
+
+	base = (char*)addr;
+	memcpy(base, &header, sizeof(OfgFileHeader));
+	getOffsets()[N] = nEntries;
+}
+
+void OfgFile::map(const char* ofgF, bool writable) {
+	int fd;
+	struct stat st;
+
+	unmap();
+	fd = open(ofgF, writable ? O_RDWR : O_RDONLY);
+	general_assert(fd >= 0, "Cannot open " + cstrtos(ofgF) + "! It may not exist.");
+	general_assert(fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(OfgFileHeader), cstrtos(ofgF) + " is not a valid Gibbs input file!");
+
+	length = st.st_size;
+	void *addr = (writable ? mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0));
+	general_assert(addr != MAP_FAILED, "Cannot map " + cstrtos(ofgF) + " into memory!");
+	close(fd);
+
+	base = (char*)addr;
+	memcpy(&header, base, sizeof(OfgFileHeader));
+
+	general_assert(!memcmp(header.magic, OFGFILE_MAGIC, sizeof(OFGFILE_MAGIC)), cstrtos(ofgF) + " is not a binary Gibbs input file! Please rerun rsem-run-em with --gibbs-out.");
+	general_assert(header.version == OFGFILE_VERSION, "Gibbs input file " + cstrtos(ofgF) + " has version " + itos(header.version) + " while version " + itos(OFGFILE_VERSION) + " is expected!");
+	general_assert(OfgFileHeader::getSize(header.N, header.nEntries) == (long long)length, cstrtos(ofgF) + " is truncated!");
+}
+
+void OfgFile::unmap() {
+	if (base == NULL) return;
+	munmap(base, length);
+	base = NULL; length = 0;
+}
+
+#endif /* OFGFILE_H_ */
@@ -25,6 +25,9 @@
 #include "ReadReader.h"
 
 #include "simul.h"
+#include "PerfLog.h"
+#include "WorkerPool.h"
+#include "MWCalculator.h"
 
 class PairedEndModel {
 public:
@@ -43,6 +46,7 @@ public:
 		mld = new LenDist();
 
 		mw = NULL;
+		pool = NULL;
 		seedLen = 0;
 	}
 
@@ -57,6 +61,7 @@ public:
 
 		ori = NULL; gld = NULL; rspd = NULL; pro = NULL; npro = NULL; mld = NULL;
 		mw = NULL;
+		pool = NULL;
 
 		if (isMaster) {
 			if (!estRSPD) rspd = new RSPD(estRSPD);
@@ -103,7 +108,7 @@ public:
 		if (fpos >= fullLen || ref.getMask(fpos)) return 0.0; // For paired-end model, fpos is the seedPos
 
 		prob = ori->getProb(dir) * gld->getAdjustedProb(insertLen, totLen) *
-		       rspd->getAdjustedProb(fpos, effL, fullLen);
+		       rspd->getPreparedProb(sid, fpos, effL, fullLen);
 
 		const SingleRead& mate1 = read.getMate1();
 		prob *= mld->getAdjustedProb(mate1.getReadLength(), insertLen) *
@@ -175,6 +180,10 @@ public:
 
 	void collect(const PairedEndModel&);
 
+	// what collect() adds up, as a flat array (see Profile::packStats), for adding up across processes
+	int packStats(double* buf) const;
+	int collectStats(const double* buf);
+
 	bool getNeedCalcConPrb() { return needCalcConPrb; }
 	void setNeedCalcConPrb(bool value) { needCalcConPrb = value; }
 
@@ -182,6 +191,9 @@ public:
 	void write(const char*);
 
 	const LenDist& getGLD() { return *gld; }
+	// base-emission profiles, for the emission benchmark (benchEmission.cpp)
+	Profile& getProfile() { return *pro; }
+	NoiseProfile& getNoiseProfile() { return *npro; }
 
 	void startSimulation(simul*, double*);
 	bool simulate(int, PairedEndRead&, int&);
@@ -193,6 +205,9 @@ public:
 	  return mw;
 	}
 
+	// calcMW runs on the threads of pool from then on, NULL to run it on the calling thread
+	void setWorkerPool(WorkerPool* pool) { this->pool = pool; }
+
 	int getModelType() const { return model_type; }
 
 private:
@@ -217,6 +232,7 @@ private:
 	double *theta_cdf; // for simulation
 
 	double *mw; // for masking
+	WorkerPool *pool; // for calcMW, not owned
 
 	void calcMW();
 };
@@ -260,6 +276,7 @@ void PairedEndModel::estimateFromReads(const char* readFN) {
     mld->finish();
     npro->calcInitParams();
 
+    rspd->prepare(refs);
     mw = new double[M + 1];
     calcMW();
 }
@@ -287,6 +304,24 @@ void PairedEndModel::collect(const PairedEndModel& o) {
 	npro->collect(*(o.npro));
 }
 
+int PairedEndModel::packStats(double* buf) const {
+	int n = 0;
+	n += gld->packStats(buf == NULL ? NULL : buf + n);
+	if (estRSPD) n += rspd->packStats(buf == NULL ? NULL : buf + n);
+	n += pro->packStats(buf == NULL ? NULL : buf + n);
+	n += npro->packStats(buf == NULL ? NULL : buf + n);
+	return n;
+}
+
+int PairedEndModel::collectStats(const double* buf) {
+	int n = 0;
+	n += gld->collectStats(buf + n);
+	if (estRSPD) n += rspd->collectStats(buf + n);
+	n += pro->collectStats(buf + n);
+	n += npro->collectStats(buf + n);
+	return n;
+}
+
 //Only master node can call
 void PairedEndModel::read(const char* inpF) {
 	int val;
@@ -312,6 +347,8 @@ void PairedEndModel::read(const char* inpF) {
 	}
 
 	fclose(fi);
+
+	if (refs != NULL) rspd->prepare(refs);
 }
 
 //Only master node can call. Only be called at EM.cpp
@@ -407,39 +444,11 @@ void PairedEndModel::finishSimulation() {
 }
 
 void PairedEndModel::calcMW() {
+	PerfScope scope("calcMW");
 	assert(mld->getMinL() >= seedLen);
 
-	memset(mw, 0, sizeof(double) * (M + 1));
-	mw[0] = 1.0;
-
-	for (int i = 1; i <= M; i++) {
-		RefSeq& ref = refs->getRef(i);
-		int totLen = ref.getTotLen();
-		int fullLen = ref.getFullLen();
-		int end = std::min(fullLen, totLen - gld->getMinL() + 1);
-		double value = 0.0;
-		int minL, maxL;
-		int effL, pfpos;
-
-		//seedPos is fpos here
-		for (int seedPos = 0; seedPos < end; seedPos++)
-			if (ref.getMask(seedPos)) {
-				minL = gld->getMinL();
-				maxL = std::min(gld->getMaxL(), totLen - seedPos);
-				pfpos = seedPos;
-				for (int fragLen = minL; fragLen <= maxL; fragLen++) {
-					effL = std::min(fullLen, totLen - fragLen + 1);
-					value += gld->getAdjustedProb(fragLen, totLen) * rspd->getAdjustedProb(pfpos, effL, fullLen);
-				}
-			}
-
-		mw[i] = 1.0 - value;
-
-		if (mw[i] < 1e-8) {
-			//fprintf(stderr, "Warning: %dth reference sequence is masked for almost all positions!\n", i);
-			mw[i] = 0.0;
-		}
-	}
+	MWCalculator calc(refs, gld, rspd, seedLen, true);
+	calc.calc(mw, pool);
 }
 
 #endif /* PAIREDENDMODEL_H_ */
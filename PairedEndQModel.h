@@ -26,6 +26,9 @@
 #include "ReadReader.h"
 
 #include "simul.h"
+#include "PerfLog.h"
+#include "WorkerPool.h"
+#include "MWCalculator.h"
 
 class PairedEndQModel {
 public:
@@ -45,6 +48,7 @@ public:
 		mld = new LenDist();
 
 		mw = NULL;
+		pool = NULL;
 		seedLen = 0;
 	}
 
@@ -59,6 +63,7 @@ public:
 
 		ori = NULL; gld = NULL; rspd = NULL; qd = NULL; qpro = NULL; nqpro = NULL; mld = NULL;
 		mw = NULL;
+		pool = NULL;
 
 		if (isMaster) {
 			if (!estRSPD) rspd = new RSPD(estRSPD);
@@ -107,7 +112,7 @@ public:
 		if (fpos >= fullLen || ref.getMask(fpos)) return 0.0; // For paired-end model, fpos is the seedPos
 
 		prob = ori->getProb(dir) * gld->getAdjustedProb(insertLen, totLen) *
-		       rspd->getAdjustedProb(fpos, effL, fullLen);
+		       rspd->getPreparedProb(sid, fpos, effL, fullLen);
 
 		const SingleReadQ& mate1 = read.getMate1();
 		prob *= mld->getAdjustedProb(mate1.getReadLength(), insertLen) *
@@ -180,6 +185,10 @@ public:
 
 	void collect(const PairedEndQModel&);
 
+	// what collect() adds up, as a flat array (see Profile::packStats), for adding up across processes
+	int packStats(double* buf) const;
+	int collectStats(const double* buf);
+
 	bool getNeedCalcConPrb() { return needCalcConPrb; }
 	void setNeedCalcConPrb(bool value) { needCalcConPrb = value; }
 
@@ -187,6 +196,9 @@ public:
 	void write(const char*);
 
 	const LenDist& getGLD() { return *gld; }
+	// base-emission profiles, for the emission benchmark (benchEmission.cpp)
+	QProfile& getProfile() { return *qpro; }
+	NoiseQProfile& getNoiseProfile() { return *nqpro; }
 
 	void startSimulation(simul*, double*);
 	bool simulate(int, PairedEndReadQ&, int&);
@@ -198,6 +210,9 @@ public:
 	  return mw;
 	}
 
+	// calcMW runs on the threads of pool from then on, NULL to run it on the calling thread
+	void setWorkerPool(WorkerPool* pool) { this->pool = pool; }
+
 	int getModelType() const { return model_type; }
  
 private:
@@ -223,6 +238,7 @@ private:
 	double *theta_cdf; // for simulation
 
 	double *mw; // for masking
+	WorkerPool *pool; // for calcMW, not owned
 
 	void calcMW();
 };
@@ -270,6 +286,7 @@ void PairedEndQModel::estimateFromReads(const char* readFN) {
     qd->finish();
     nqpro->calcInitParams();
 
+    rspd->prepare(refs);
     mw = new double[M + 1];
     calcMW();
 }
@@ -297,6 +314,24 @@ void PairedEndQModel::collect(const PairedEndQModel& o) {
 	nqpro->collect(*(o.nqpro));
 }
 
+int PairedEndQModel::packStats(double* buf) const {
+	int n = 0;
+	n += gld->packStats(buf == NULL ? NULL : buf + n);
+	if (estRSPD) n += rspd->packStats(buf == NULL ? NULL : buf + n);
+	n += qpro->packStats(buf == NULL ? NULL : buf + n);
+	n += nqpro->packStats(buf == NULL ? NULL : buf + n);
+	return n;
+}
+
+int PairedEndQModel::collectStats(const double* buf) {
+	int n = 0;
+	n += gld->collectStats(buf + n);
+	if (estRSPD) n += rspd->collectStats(buf + n);
+	n += qpro->collectStats(buf + n);
+	n += nqpro->collectStats(buf + n);
+	return n;
+}
+
 //Only master node can call
 void PairedEndQModel::read(const char* inpF) {
 	int val;
@@ -324,6 +359,8 @@ void PairedEndQModel::read(const char* inpF) {
 
 
 	fclose(fi);
+
+	if (refs != NULL) rspd->prepare(refs);
 }
 
 //Only master node can call. Only be called at EM.cpp
@@ -427,39 +464,11 @@ void PairedEndQModel::finishSimulation() {
 
 
 void PairedEndQModel::calcMW() {
+	PerfScope scope("calcMW");
 	assert(mld->getMinL() >= seedLen);
 
-	memset(mw, 0, sizeof(double) * (M + 1));
-	mw[0] = 1.0;
-
-	for (int i = 1; i <= M; i++) {
-		RefSeq& ref = refs->getRef(i);
-		int totLen = ref.getTotLen();
-		int fullLen = ref.getFullLen();
-		int end = std::min(fullLen, totLen - gld->getMinL() + 1);
-		double value = 0.0;
-		int minL, maxL;
-		int effL, pfpos;
-
-		//seedPos is fpos here
-		for (int seedPos = 0; seedPos < end; seedPos++)
-			if (ref.getMask(seedPos)) {
-				minL = gld->getMinL();
-				maxL = std::min(gld->getMaxL(), totLen - seedPos);
-				pfpos = seedPos;
-				for (int fragLen = minL; fragLen <= maxL; fragLen++) {
-					effL = std::min(fullLen, totLen - fragLen + 1);
-					value += gld->getAdjustedProb(fragLen, totLen) * rspd->getAdjustedProb(pfpos, effL, fullLen);
-				}
-			}
-    
-		mw[i] = 1.0 - value;
-
-		if (mw[i] < 1e-8) {
-			//      fprintf(stderr, "Warning: %dth reference sequence is masked for almost all positions!\n", i);
-			mw[i] = 0.0;
-		}
-	}
+	MWCalculator calc(refs, gld, rspd, seedLen, true);
+	calc.calc(mw, pool);
 }
 
 #endif /* PAIREDENDQMODEL_H_ */
@@ -17,8 +17,18 @@ public:
 		this->name = mate1.getName();
 	}
 
+	// same as assigning PairedEndRead(SingleRead(name1, seq1), SingleRead(name2, seq2)), but reuses the memory this read already holds
+	void set(const char* name1, const std::string& seq1, const char* name2, const std::string& seq2) {
+		mate1.set(name1, seq1);
+		mate2.set(name2, seq2);
+		name = name1;
+		low_quality = false;
+	}
+
 	bool read(int argc, std::istream* argv[], int flags = 7);
 	void write(int argc, std::ostream* argv[]);
+	bool read(const ReadStore& store, long rid, int flags = 7); // mates are records 2 * rid and 2 * rid + 1
+	bool write(ReadStore& store) const;
 
 	const SingleRead& getMate1() const { return mate1; }
 	const SingleRead& getMate2() const { return mate2; }
@@ -55,6 +65,16 @@ void PairedEndRead::write(int argc, std::ostream *argv[]) {
 	mate2.write(1, outMate2);
 }
 
+bool PairedEndRead::read(const ReadStore& store, long rid, int flags) {
+	assert(store.getNMates() == 2);
+	name = "";
+	return mate1.read(store, 2 * rid, flags) && mate2.read(store, 2 * rid + 1, flags);
+}
+
+bool PairedEndRead::write(ReadStore& store) const {
+	return mate1.write(store) && mate2.write(store);
+}
+
 //calculate if this read is low quality
 void PairedEndRead::calc_lq(bool hasPolyA, int seedLen) {
 	low_quality = false;
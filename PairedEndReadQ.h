@@ -17,8 +17,18 @@ public:
 		this->name = mate1.getName();
 	}
 
+	// same as assigning PairedEndReadQ(SingleReadQ(name1, seq1, qual1), SingleReadQ(name2, seq2, qual2)), but reuses the memory this read already holds
+	void set(const char* name1, const std::string& seq1, const std::string& qual1, const char* name2, const std::string& seq2, const std::string& qual2) {
+		mate1.set(name1, seq1, qual1);
+		mate2.set(name2, seq2, qual2);
+		name = name1;
+		low_quality = false;
+	}
+
 	bool read(int argc, std::istream* argv[], int flags = 7);
 	void write(int argc, std::ostream* argv[]);
+	bool read(const ReadStore& store, long rid, int flags = 7); // mates are records 2 * rid and 2 * rid + 1
+	bool write(ReadStore& store) const;
 
 	const SingleReadQ& getMate1() const { return mate1; }
 	const SingleReadQ& getMate2() const { return mate2; }
@@ -55,6 +65,16 @@ void PairedEndReadQ::write(int argc, std::ostream* argv[]) {
 	mate2.write(1, outMate2);
 }
 
+bool PairedEndReadQ::read(const ReadStore& store, long rid, int flags) {
+	assert(store.getNMates() == 2);
+	name = "";
+	return mate1.read(store, 2 * rid, flags) && mate2.read(store, 2 * rid + 1, flags);
+}
+
+bool PairedEndReadQ::write(ReadStore& store) const {
+	return mate1.write(store) && mate2.write(store);
+}
+
 //calculate if this read is low quality
 void PairedEndReadQ::calc_lq(bool hasPolyA, int seedLen) {
 	low_quality = false;
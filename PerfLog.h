@@ -0,0 +1,116 @@
+#ifndef PERFLOG_H_
+#define PERFLOG_H_
+
+/**
+Machine readable timings of the phases of a run, one tab separated line per timed event, for tracking
+performance across releases and data sets. Columns:
+
+  phase   : name of the phase, e.g. "E step"
+  round   : EM round (pass for component EM) the event belongs to, 0 outside the EM rounds
+  wall    : wall time in seconds
+  reads   : number of reads (or equivalence classes) processed, 0 if not applicable
+  hits    : number of hits (or class entries) touched, 0 if not applicable
+  bytes   : number of bytes read from or written to files, 0 if none
+  threads : busy time in seconds of each worker thread, separated by commas, "-" for a single threaded phase
+
+Nothing is recorded unless the log is open, so phases can be timed unconditionally.
+ */
+
+#include<cstdio>
+#include<string>
+#include<sys/time.h>
+#include<sys/resource.h>
+#include<unistd.h>
+
+#include "my_assert.h"
+
+class PerfLog {
+public:
+	PerfLog() { fo = NULL; round = 0; }
+	~PerfLog() { close(); }
+
+	void open(const char* outF);
+	void close();
+	bool isOpen() const { return fo != NULL; }
+
+	// stop recording without closing the file, for a forked process which shares the file with its parent
+	void detach() { fo = NULL; }
+
+	// round attached to the records that follow
+	void setRound(int round) { this->round = round; }
+
+	void record(const std::string& phase, double wallTime, long long reads = 0, long long hits = 0, long long bytes = 0, int nThreads = 0, const double* threadTimes = NULL);
+
+	static double getTime() {
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + tv.tv_usec * 1e-6;
+	}
+
+	// current resident set size of this process in MB, -1 if it cannot be read
+	static double getResidentMB() {
+		long pages, resident;
+		FILE *fi = fopen("/proc/self/statm", "r");
+		if (fi == NULL) return -1.0;
+		bool ok = (fscanf(fi, "%ld %ld", &pages, &resident) == 2);
+		fclose(fi);
+		return (ok ? (double)resident * sysconf(_SC_PAGESIZE) / 1048576.0 : -1.0);
+	}
+
+	// peak resident set size of this process so far in MB
+	static double getPeakResidentMB() {
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) return -1.0;
+		return usage.ru_maxrss / 1024.0; // ru_maxrss is in KB
+	}
+
+private:
+	FILE *fo;
+	int round;
+};
+
+void PerfLog::open(const char* outF) {
+	close();
+	fo = fopen(outF, "w");
+	general_assert(fo != NULL, "Cannot create " + cstrtos(outF) + "!");
+	fprintf(fo, "phase\tround\twall\treads\thits\tbytes\tthreads\n");
+}
+
+void PerfLog::close() {
+	if (fo == NULL) return;
+	fclose(fo);
+	fo = NULL;
+}
+
+void PerfLog::record(const std::string& phase, double wallTime, long long reads, long long hits, long long bytes, int nThreads, const double* threadTimes) {
+	if (fo == NULL) return;
+	fprintf(fo, "%s\t%d\t%.6f\t%lld\t%lld\t%lld\t", phase.c_str(), round, wallTime, reads, hits, bytes);
+	if (nThreads == 0) fprintf(fo, "-");
+	for (int i = 0; i < nThreads; i++) fprintf(fo, "%s%.6f", (i > 0 ? "," : ""), threadTimes[i]);
+	fprintf(fo, "\n");
+}
+
+PerfLog perfLog; // shared by everything in the program, opened by the main function if the user asks for it
+
+// times one phase from construction to stop(), records it in perfLog
+class PerfScope {
+public:
+	PerfScope(const std::string& phase) : phase(phase) { reads = hits = bytes = 0; stopped = false; start = PerfLog::getTime(); }
+	~PerfScope() { stop(); }
+
+	void setCounts(long long reads, long long hits, long long bytes) { this->reads = reads; this->hits = hits; this->bytes = bytes; }
+
+	void stop() {
+		if (stopped) return;
+		stopped = true;
+		perfLog.record(phase, PerfLog::getTime() - start, reads, hits, bytes);
+	}
+
+private:
+	std::string phase;
+	long long reads, hits, bytes;
+	bool stopped;
+	double start;
+};
+
+#endif /* PERFLOG_H_ */
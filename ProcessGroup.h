@@ -0,0 +1,185 @@
+#ifndef PROCESSGROUP_H_
+#define PROCESSGROUP_H_
+
+/**
+A group of processes on one machine which add up arrays over shared memory (an allreduce), so that a
+computation can be split over processes as well as over threads.
+
+The group is created by one process; start() forks the others. Each process has a rank, 0 for the process
+which created the group. Every process must call allreduce(), reduce() and barrier() in the same order with
+the same lengths. Sums are formed in rank order by every process, so all processes get bit for bit the same
+result. Arrays longer than the slots are summed a slot at a time.
+
+There are two sets of slots used in turn, so one barrier per allreduce is enough: a process can only write
+into a set once every process has passed the barrier of the allreduce after the one which read it.
+
+If a process dies, the others notice while waiting and exit with an error instead of waiting forever.
+ */
+
+#include<cstdio>
+#include<cstring>
+#include<cstdlib>
+#include<cassert>
+#include<algorithm>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/types.h>
+#include<sys/wait.h>
+
+#include "utils.h"
+#include "my_assert.h"
+
+class ProcessGroup {
+public:
+	// maxLen : doubles per slot, longer arrays take several rounds of exchange
+	ProcessGroup(int nProcs, int maxLen);
+	~ProcessGroup();
+
+	// fork the other processes, returns the rank of the calling process
+	int start();
+
+	int getNProcs() const { return nProcs; }
+	int getRank() const { return rank; }
+	int getMaxLen() const { return maxLen; }
+
+	// replace data by its sum over all processes
+	void allreduce(double* data, int len) { exchange(data, len, true); }
+	// the same, but only process 0 gets the sum, the data of the others is left as it is; with every value
+	// nonzero in one process only, this gathers the parts of an array into process 0
+	void reduce(double* data, int len) { exchange(data, len, false); }
+
+	// wait until every process has arrived here
+	void barrier();
+
+	// processes other than 0 exit here; process 0 waits for them and fails if one of them failed
+	void finish();
+
+private:
+	struct Header {
+		volatile int arrived; // processes arrived at the current barrier
+		volatile int generation; // number of barriers passed
+		volatile int failed; // set by process 0 when another process died
+	};
+
+	static const int WAIT_US = 50; // sleep between checks while waiting at a barrier
+
+	int nProcs, maxLen, rank;
+	int set; // set of slots the next allreduce uses
+	size_t size; // bytes mapped
+	void *mem;
+	Header *header;
+	double *slots; // slots[(set * nProcs + rank) * maxLen + i]
+	pid_t *pids; // pids[r] : process of rank r, filled in process 0 only
+	pid_t parent; // process 0
+
+	void exchange(double* data, int len, bool toAll);
+	void exchangeSlot(double* data, int len, bool toAll); // len <= maxLen
+	void checkOthers(); // exit if another process died
+};
+
+ProcessGroup::ProcessGroup(int nProcs, int maxLen) {
+	assert(nProcs > 0 && maxLen > 0);
+	this->nProcs = nProcs;
+	this->maxLen = maxLen;
+	rank = 0;
+	set = 0;
+
+	size = sizeof(Header) + sizeof(double) * 2 * nProcs * maxLen;
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	general_assert(mem != MAP_FAILED, "Cannot map " + itos((int)(size >> 20)) + " MB of shared memory!");
+	header = (Header*)mem;
+	header->arrived = header->generation = header->failed = 0;
+	slots = (double*)((char*)mem + sizeof(Header));
+
+	pids = new pid_t[nProcs];
+	parent = pids[0] = getpid();
+}
+
+ProcessGroup::~ProcessGroup() {
+	delete[] pids;
+	munmap(mem, size);
+}
+
+int ProcessGroup::start() {
+	fflush(NULL); // otherwise whatever is buffered would be written by every process
+
+	for (int r = 1; r < nProcs; r++) {
+		pid_t pid = fork();
+		general_assert(pid >= 0, "Cannot create process " + itos(r) + "!");
+		if (pid == 0) { rank = r; return rank; }
+		pids[r] = pid;
+	}
+
+	return rank;
+}
+
+void ProcessGroup::checkOthers() {
+	int status;
+
+	if (rank > 0) {
+		if (header->failed || getppid() != parent) _exit(1);
+		return;
+	}
+
+	for (int r = 1; r < nProcs; r++)
+		if (waitpid(pids[r], &status, WNOHANG) == pids[r]) {
+			header->failed = 1;
+			fprintf(stderr, "Process %d (numbered from 0) exited before the others finished!\n", r);
+			exit(-1);
+		}
+}
+
+void ProcessGroup::barrier() {
+	int gen = header->generation;
+
+	if (__sync_add_and_fetch(&header->arrived, 1) == nProcs) {
+		header->arrived = 0;
+		__sync_fetch_and_add(&header->generation, 1);
+		return;
+	}
+
+	while (header->generation == gen) {
+		checkOthers();
+		usleep(WAIT_US);
+	}
+	__sync_synchronize();
+}
+
+void ProcessGroup::exchange(double* data, int len, bool toAll) {
+	if (nProcs == 1) return;
+	for (int fr = 0; fr < len; fr += maxLen)
+		exchangeSlot(data + fr, std::min(maxLen, len - fr), toAll);
+}
+
+void ProcessGroup::exchangeSlot(double* data, int len, bool toAll) {
+	assert(len <= maxLen);
+
+	double *base = slots + (size_t)set * nProcs * maxLen;
+
+	memcpy(base + (size_t)rank * maxLen, data, sizeof(double) * len);
+	barrier();
+	set ^= 1;
+	if (!toAll && rank > 0) return;
+
+	memset(data, 0, sizeof(double) * len);
+	for (int r = 0; r < nProcs; r++) {
+		const double *slot = base + (size_t)r * maxLen;
+		for (int i = 0; i < len; i++) data[i] += slot[i];
+	}
+}
+
+void ProcessGroup::finish() {
+	int status;
+
+	if (rank > 0) {
+		fflush(NULL);
+		_exit(0);
+	}
+
+	for (int r = 1; r < nProcs; r++) {
+		general_assert(waitpid(pids[r], &status, 0) == pids[r], "Cannot wait for process " + itos(r) + "!");
+		general_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "Process " + itos(r) + " (numbered from 0) failed!");
+	}
+}
+
+#endif /* PROCESSGROUP_H_ */
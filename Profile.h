@@ -6,6 +6,7 @@
 #include<cassert>
 
 #include "utils.h"
+#include "Emission.h"
 #include "RefSeq.h"
 #include "simul.h"
 
@@ -27,6 +28,10 @@ public:
 
 	void collect(const Profile&);
 
+	// what collect() adds up, as a flat array for adding up across processes; both return the number of doubles
+	int packStats(double* buf) const; // only counts if buf is NULL
+	int collectStats(const double* buf); // adds buf in, like collect()
+
 	void read(FILE*);
 	void write(FILE*);
 
@@ -90,9 +95,7 @@ void Profile::init() {
 
 void Profile::update(const std::string& readseq, const RefSeq& refseq, int pos, int dir, double frac) {
 	int len = readseq.size();
-	for (int i = 0; i < len; i++) {
-		p[i][refseq.get_id(i + pos, dir)][get_base_id(readseq[i])] += frac;
-	}
+	emissionUpdate(&p[0][0][0], readseq.c_str(), NULL, refseq.getBasePtr(pos, len, dir), dir, NCODES * NCODES, NCODES, len, frac);
 }
 
 void Profile::finish() {
@@ -112,15 +115,8 @@ void Profile::finish() {
 }
 
 double Profile::getProb(const std::string& readseq, const RefSeq& refseq, int pos, int dir) {
-	double prob = 1.0;
 	int len = readseq.size();
-
-	for (int i = 0; i < len; i++) {
-		prob *= p[i][refseq.get_id(i + pos, dir)][get_base_id(readseq[i])];
-
-	}
-
-	return prob;
+	return emissionProb(&p[0][0][0], readseq.c_str(), NULL, refseq.getBasePtr(pos, len, dir), dir, NCODES * NCODES, NCODES, len);
 }
 
 void Profile::collect(const Profile& o) {
@@ -130,6 +126,17 @@ void Profile::collect(const Profile& o) {
 				p[i][j][k] += o.p[i][j][k];
 }
 
+int Profile::packStats(double* buf) const {
+	if (buf != NULL) memcpy(buf, p, sizeof(double) * size);
+	return size;
+}
+
+int Profile::collectStats(const double* buf) {
+	double *q = &p[0][0][0];
+	for (int i = 0; i < size; i++) q[i] += buf[i];
+	return size;
+}
+
 void Profile::read(FILE *fi) {
 	int tmp_prolen, tmp_ncodes;
 	assert(fscanf(fi, "%d %d", &tmp_prolen, &tmp_ncodes) == 2);
@@ -6,6 +6,7 @@
 #include<cassert>
 
 #include "utils.h"
+#include "Emission.h"
 #include "RefSeq.h"
 #include "simul.h"
 
@@ -23,6 +24,10 @@ public:
 
 	void collect(const QProfile&);
 
+	// what collect() adds up, as a flat array for adding up across processes; both return the number of doubles
+	int packStats(double* buf) const; // only counts if buf is NULL
+	int collectStats(const double* buf); // adds buf in, like collect()
+
 	void read(FILE*);
 	void write(FILE*);
 
@@ -87,9 +92,7 @@ void QProfile::init() {
 
 void QProfile::update(const std::string& readseq, const std::string& qual, const RefSeq& refseq, int pos, int dir, double frac) {
 	int len = readseq.size();
-	for (int i = 0; i < len; i++) {
-	  p[c2q(qual[i])][refseq.get_id(i + pos, dir)][get_base_id(readseq[i])] += frac;
-	}
+	emissionUpdate(&p[0][0][0], readseq.c_str(), qual.c_str(), refseq.getBasePtr(pos, len, dir), dir, NCODES * NCODES, NCODES, len, frac);
 }
 
 void QProfile::finish() {
@@ -109,14 +112,8 @@ void QProfile::finish() {
 }
 
 double QProfile::getProb(const std::string& readseq, const std::string& qual, const RefSeq& refseq, int pos, int dir) {
-	double prob = 1.0;
 	int len = readseq.size();
-
-	for (int i = 0; i < len; i++) {
-		prob *= p[c2q(qual[i])][refseq.get_id(i + pos, dir)][get_base_id(readseq[i])];
-	}
-
-	return prob;
+	return emissionProb(&p[0][0][0], readseq.c_str(), qual.c_str(), refseq.getBasePtr(pos, len, dir), dir, NCODES * NCODES, NCODES, len);
 }
 
 void QProfile::collect(const QProfile& o) {
@@ -126,6 +123,19 @@ void QProfile::collect(const QProfile& o) {
 				p[i][j][k] += o.p[i][j][k];
 }
 
+int QProfile::packStats(double* buf) const {
+	int size = SIZE * NCODES * NCODES;
+	if (buf != NULL) memcpy(buf, p, sizeof(double) * size);
+	return size;
+}
+
+int QProfile::collectStats(const double* buf) {
+	int size = SIZE * NCODES * NCODES;
+	double *q = &p[0][0][0];
+	for (int i = 0; i < size; i++) q[i] += buf[i];
+	return size;
+}
+
 void QProfile::read(FILE *fi) {
 	int tmp_size, tmp_ncodes;
 	assert(fscanf(fi, "%d %d", &tmp_size, &tmp_ncodes) == 2);
@@ -4,6 +4,8 @@
 #include<cstdio>
 #include<cstring>
 #include<cassert>
+#include<vector>
+#include<algorithm>
 
 #include "utils.h"
 #include "RefSeq.h"
@@ -28,6 +30,7 @@ public:
 			pdf[i] = 1.0 / B;
 			cdf[i] = i * 1.0 / B;
 		}
+		calcFullNorm();
 	}
 
 	~RSPD() {
@@ -60,7 +63,7 @@ public:
 
 	void finish();
 
-	double evalCDF(int fpos, int fullLen) {
+	double evalCDF(int fpos, int fullLen) const {
 		int i = ((long long)fpos) * B / fullLen;
 		double val = fpos * 1.0 / fullLen * B;
 
@@ -74,8 +77,40 @@ public:
 		return (denom >= EPSILON ? (evalCDF(fpos + 1, fullLen) - evalCDF(fpos, fullLen)) / denom : 0.0) ;
 	}
 
+	// per transcript constants of getPreparedProb, they depend on the transcript lengths only
+	void prepare(Refs* refs);
+
+	// getAdjustedProb of transcript sid without integer divisions; only the denominator of effL < fullLen is
+	// still divided by, the whole-transcript one is precomputed
+	double getPreparedProb(int sid, int fpos, int effL, int fullLen) const {
+		assert(sid > 0 && sid < (int)rFullLens.size() && fpos >= 0 && fpos < fullLen && effL <= fullLen);
+		double rFullLen = rFullLens[sid];
+		if (!estRSPD) return (effL == fullLen ? rFullLen : 1.0 / effL);
+		double scale = B * rFullLen;
+		double numer = evalScaledCDF(fpos + 1, scale) - evalScaledCDF(fpos, scale);
+		if (effL == fullLen) return numer * fullNorm;
+		double denom = evalScaledCDF(effL, scale);
+		return (denom >= EPSILON ? numer / denom : 0.0);
+	}
+
+	// numerator and denominator of getAdjustedProb, for callers which sum over many fpos or effL
+	double getPosProb(int fpos, int fullLen) const { return estRSPD ? evalCDF(fpos + 1, fullLen) - evalCDF(fpos, fullLen) : 1.0; }
+	double getAdjustedDenom(int effL, int fullLen) const { return estRSPD ? evalCDF(effL, fullLen) : effL; }
+
+	bool isEstimated() const { return estRSPD; }
+	int getB() const { return B; }
+
+	// splits [fr, to] into runs of positions sharing one getPosProb and calls visitor(runFr, runTo, posProb) on each;
+	// a run is the positions inside one bin, or a single position straddling two bins
+	template<class Visitor>
+	void visitPosRuns(int fr, int to, int fullLen, Visitor& visitor) const;
+
 	void collect(const RSPD&);
 
+	// what collect() adds up, as a flat array for adding up across processes; both return the number of doubles
+	int packStats(double* buf) const; // only counts if buf is NULL
+	int collectStats(const double* buf); // adds buf in, like collect()
+
 	void read(FILE*);
 	void write(FILE*);
 
@@ -87,6 +122,17 @@ private:
 	bool estRSPD;
 	int B; // number of bins
 	double *pdf, *cdf;
+	double fullNorm; // 1 / evalCDF(fullLen, fullLen) = 1 / cdf[B], 0 if cdf[B] < EPSILON
+	std::vector<double> rFullLens; // rFullLens[sid] = 1 / fullLen of transcript sid, filled by prepare()
+
+	// evalCDF with scale = B / fullLen; the bin may be off by one at a boundary, where the CDF is continuous
+	double evalScaledCDF(int fpos, double scale) const {
+		double val = fpos * scale;
+		int i = (int)val;
+		return cdf[i] + (val - i) * pdf[i + 1];
+	}
+
+	void calcFullNorm() { fullNorm = (cdf[B] >= EPSILON ? 1.0 / cdf[B] : 0.0); }
 
 	int M;
 	double **rspdDists;
@@ -103,10 +149,29 @@ RSPD& RSPD::operator=(const RSPD& rv) {
 	B = rv.B;
 	memcpy(pdf, rv.pdf, sizeof(double) * (B + 2));
 	memcpy(cdf, rv.cdf, sizeof(double) * (B + 2));
+	fullNorm = rv.fullNorm;
+	rFullLens = rv.rFullLens;
 
 	return *this;
 }
 
+template<class Visitor>
+void RSPD::visitPosRuns(int fr, int to, int fullLen, Visitor& visitor) const {
+	if (!estRSPD) {
+		if (fr <= to) visitor(fr, to, 1.0);
+		return;
+	}
+
+	int x = fr;
+	while (x <= to) {
+		long long bin = (long long)x * B / fullLen;
+		int end = std::min(to, (int)((bin + 1) * fullLen / B) - 1); // positions up to end lie inside the bin
+		if (end < x) end = x;
+		visitor(x, end, getPosProb(x, fullLen));
+		x = end + 1;
+	}
+}
+
 void RSPD::init() {
 	assert(estRSPD);
 	memset(pdf, 0, sizeof(double) * (B + 2));
@@ -126,6 +191,7 @@ void RSPD::finish() {
 		pdf[i] /= sum;
 		cdf[i] = cdf[i - 1] + pdf[i];
 	}
+	calcFullNorm();
 }
 
 void RSPD::collect(const RSPD& o) {
@@ -135,6 +201,18 @@ void RSPD::collect(const RSPD& o) {
 	}
 }
 
+int RSPD::packStats(double* buf) const {
+	assert(estRSPD);
+	if (buf != NULL) memcpy(buf, pdf + 1, sizeof(double) * B);
+	return B;
+}
+
+int RSPD::collectStats(const double* buf) {
+	assert(estRSPD);
+	for (int i = 1; i <= B; i++) pdf[i] += buf[i - 1];
+	return B;
+}
+
 void RSPD::read(FILE *fi) {
 	//release default space first
 	delete[] pdf;
@@ -166,6 +244,13 @@ void RSPD::read(FILE *fi) {
 			cdf[i] = i * 1.0 / B;
 		}
 	}
+	calcFullNorm();
+}
+
+void RSPD::prepare(Refs* refs) {
+	int M = refs->getM();
+	rFullLens.assign(M + 1, 0.0);
+	for (int i = 1; i <= M; i++) rFullLens[i] = 1.0 / refs->getRef(i).getFullLen();
 }
 
 void RSPD::write(FILE *fo) {
@@ -3,6 +3,7 @@
 
 #include<cstdio>
 #include<cstdlib>
+#include<cassert>
 #include<iostream>
 #include<fstream>
 
@@ -44,6 +45,16 @@ struct ReadIndex {
 		if (index != NULL) delete[] index;
 	}
 
+	// average size in bytes of the reads in rid's run of gap reads, fileSize is where the last run ends; 0 without an index
+	double getReadBytes(long rid, long long fileSize) const {
+		if (index == NULL || nPos == 0) return 0.0;
+		assert(rid >= 0 && rid < nReads);
+		long g = rid / gap;
+		long long fr = (std::streamoff)index[g], to = (g + 1 < nPos ? (long long)(std::streamoff)index[g + 1] : fileSize);
+		long n = (nReads - g * gap < gap ? nReads - g * gap : gap);
+		return (double)(to - fr) / n;
+	}
+
 	//rid  0-based , return crid : current seeked rid
 	long locate(long rid, std::ifstream& out) {
 		if (index == NULL) {
@@ -56,4 +67,47 @@ struct ReadIndex {
 	}
 };
 
+// Writes the .ridx of a read file, add() takes the position of every read in order. Used while the read file is written (rsem-parse-alignments) or read (rsem-build-read-index).
+struct ReadIndexWriter {
+	long nReads;
+	int gap, nPos;
+	std::ofstream fout;
+
+	ReadIndexWriter(const char* readF, int gap) {
+		char indexF[STRLEN];
+
+		sprintf(indexF, "%s.ridx", readF);
+		fout.open(indexF, std::ios::binary);
+		if (!fout.is_open()) { fprintf(stderr, "Cannot create %s!\n", indexF); exit(-1); }
+
+		nReads = 0; nPos = 0;
+		this->gap = gap;
+		writeHeader(); // rewritten by close()
+	}
+
+	~ReadIndexWriter() {
+		if (fout.is_open()) close();
+	}
+
+	void add(std::streampos pos) {
+		if (nReads % gap == 0) {
+			++nPos;
+			fout.write((char*)&pos, sizeof(pos));
+		}
+		++nReads;
+	}
+
+	void close() {
+		fout.seekp(0, std::ios::beg);
+		writeHeader();
+		fout.close();
+	}
+
+	void writeHeader() {
+		fout.write((char*)&nReads, sizeof(nReads));
+		fout.write((char*)&gap, sizeof(gap));
+		fout.write((char*)&nPos, sizeof(nPos));
+	}
+};
+
 #endif /* READINDEX_H_ */
@@ -14,12 +14,13 @@
 #include "PairedEndRead.h"
 #include "PairedEndReadQ.h"
 #include "ReadIndex.h"
+#include "ReadStore.h"
 
 
 template<class ReadType>
 class ReadReader {
 public:
-	ReadReader() { s = 0; indices = NULL; arr = NULL; hasPolyA = false; seedLen = -1; }
+	ReadReader() { s = 0; indices = NULL; arr = NULL; store = NULL; storeFirst = 0; hasPolyA = false; seedLen = -1; }
 	ReadReader(int s, char readFs[][STRLEN], bool hasPolyA = false, int seedLen = -1);
 	~ReadReader();
 
@@ -27,11 +28,21 @@ public:
 		this->indices = indices;
 	}
 
+	// serve reads from an in-memory store instead of the files, starting from the first read; the store holds
+	// reads first, first + 1, ... (a process may only keep the reads of its own blocks)
+	void setStore(const ReadStore* store, long first = 0) {
+		this->store = store;
+		storeFirst = first;
+		start = cur = 0;
+	}
+
 	bool locate(long); // You should guarantee that indices exist and rid is valid, otherwise return false; If it fails, you should reset it manually!
 	void reset();
 
 	bool next(ReadType& read, int flags = 7) {
-		bool success = read.read(s, (std::istream**)arr, flags);
+		bool success;
+		if (store != NULL) success = (cur < store->getNReads() && read.read(*store, cur++, flags));
+		else success = read.read(s, (std::istream**)arr, flags);
 		if (success && seedLen > 0) { read.calc_lq(hasPolyA, seedLen); }
 		return success;
 	}
@@ -42,6 +53,10 @@ private:
 	std::ifstream** arr;
 	std::streampos *locations;
 
+	const ReadStore *store;
+	long storeFirst; // id of the first read in store
+	long start, cur; // read positions in store
+
 	bool hasPolyA;
 	int seedLen;
 };
@@ -53,6 +68,8 @@ ReadReader<ReadType>::ReadReader(int s, char readFs[][STRLEN], bool hasPolyA, in
 	arr = new std::ifstream*[s];
 	locations = new std::streampos[s];
 	indices = NULL;
+	store = NULL;
+	storeFirst = start = cur = 0;
 	for (int i = 0; i < s; i++) {
 		arr[i] = new std::ifstream(readFs[i]);
 		if (!arr[i]->is_open()) { fprintf(stderr, "Cannot open %s! It may not exist.\n", readFs[i]); exit(-1); }
@@ -82,6 +99,12 @@ bool ReadReader<ReadType>::locate(long rid) {
 	long crid = -1;
 	ReadType read;
 
+	if (store != NULL) {
+		if (rid < storeFirst || rid - storeFirst >= store->getNReads()) return false;
+		start = cur = rid - storeFirst;
+		return true;
+	}
+
 	if (indices == NULL) return false;
 
 	//We should make sure that crid returned by each indices is the same
@@ -109,6 +132,7 @@ bool ReadReader<ReadType>::locate(long rid) {
 
 template<class ReadType>
 void ReadReader<ReadType>::reset() {
+	if (store != NULL) { cur = start; return; }
 	for (int i = 0; i < s; i++) {
 		arr[i]->seekg(locations[i]);
 	}
@@ -0,0 +1,145 @@
+#ifndef READSTORE_H_
+#define READSTORE_H_
+
+/**
+Alignable reads kept in memory, so that passes over them do not go back to the read files.
+
+A read has one record per mate, record k of read rid is rid * nMates + mate (mate is 0 or 1).
+Sequences are packed 2 bits per base (A, C, G, T); any other character is stored as an exception
+(position, character) and patched in when the record is decoded. Quality strings, if any, are kept
+as they are, one byte per base. Read names are not kept.
+
+Decoding goes into caller-owned strings, which keep their capacity, so serving reads allocates nothing
+once the strings have grown to the longest read.
+ */
+
+#include<cassert>
+#include<string>
+#include<vector>
+#include<algorithm>
+
+class ReadStore {
+public:
+	ReadStore() { clear(); }
+
+	void clear();
+
+	// nMates : 1 or 2; hasQual : whether quality scores are stored; budget : maximum size in bytes
+	void init(int nMates, bool hasQual, long long budget);
+
+	// append a record, returns false if the store would exceed its budget (the store is cleared then)
+	bool push(const std::string& seq, const std::string* qual);
+
+	void finish(); // release spare capacity after the last push
+
+	bool isEmpty() const { return nRecords == 0; }
+	int getNMates() const { return nMates; }
+	long getNReads() const { return (nMates > 0 ? nRecords / nMates : 0); }
+	long long getSize() const { return size; } // approximate memory used, in bytes
+
+	int getLength(long k) const { assert(k >= 0 && k < nRecords); return (int)(starts[k + 1] - starts[k]); }
+	void getSeq(long k, std::string& seq) const;
+	void getQual(long k, std::string& qual) const;
+
+private:
+	int nMates;
+	bool hasQual;
+	long nRecords;
+	long long budget, size;
+
+	std::vector<long long> starts; // position of each record's first base, records are stored back to back
+	std::vector<unsigned char> bases; // 4 bases per byte, base p at bits 2 * (p % 4) of byte p / 4
+	std::vector<char> quals;
+	std::vector<long long> excPos; // positions of bases other than A, C, G, T, in increasing order
+	std::vector<char> excChars;
+
+	static int encode(char c) {
+		switch(c) {
+		case 'A' : return 0;
+		case 'C' : return 1;
+		case 'G' : return 2;
+		case 'T' : return 3;
+		default : return -1;
+		}
+	}
+};
+
+void ReadStore::clear() {
+	nMates = 0;
+	hasQual = false;
+	nRecords = 0;
+	budget = size = 0;
+
+	starts.assign(1, 0);
+	std::vector<unsigned char>().swap(bases);
+	std::vector<char>().swap(quals);
+	std::vector<long long>().swap(excPos);
+	std::vector<char>().swap(excChars);
+}
+
+void ReadStore::init(int nMates, bool hasQual, long long budget) {
+	assert(nMates == 1 || nMates == 2);
+	clear();
+	this->nMates = nMates;
+	this->hasQual = hasQual;
+	this->budget = budget;
+}
+
+bool ReadStore::push(const std::string& seq, const std::string* qual) {
+	int len = seq.length();
+	long long pos = starts.back();
+	int code;
+
+	assert(!hasQual || (qual != NULL && (int)qual->length() == len));
+
+	size += sizeof(long long) + (len + 3) / 4 + (hasQual ? len : 0);
+	if (size > budget) { clear(); return false; }
+
+	bases.resize((pos + len + 3) / 4, 0);
+	for (int i = 0; i < len; i++, pos++) {
+		code = encode(seq[i]);
+		if (code < 0) {
+			excPos.push_back(pos);
+			excChars.push_back(seq[i]);
+			size += sizeof(long long) + 1;
+			code = 0;
+		}
+		bases[pos >> 2] |= (unsigned char)(code << ((pos & 3) << 1));
+	}
+	if (hasQual) quals.insert(quals.end(), qual->begin(), qual->end());
+
+	starts.push_back(pos);
+	++nRecords;
+
+	return true;
+}
+
+void ReadStore::finish() {
+	std::vector<long long>(starts).swap(starts);
+	std::vector<unsigned char>(bases).swap(bases);
+	std::vector<char>(quals).swap(quals);
+	std::vector<long long>(excPos).swap(excPos);
+	std::vector<char>(excChars).swap(excChars);
+}
+
+void ReadStore::getSeq(long k, std::string& seq) const {
+	static const char bchars[4] = {'A', 'C', 'G', 'T'};
+	long long fr = starts[k], to = starts[k + 1];
+
+	seq.resize(to - fr);
+	for (long long p = fr; p < to; p++) {
+		seq[p - fr] = bchars[(bases[p >> 2] >> ((p & 3) << 1)) & 3];
+	}
+
+	std::vector<long long>::const_iterator it = std::lower_bound(excPos.begin(), excPos.end(), fr);
+	for (; it != excPos.end() && *it < to; ++it) {
+		seq[*it - fr] = excChars[it - excPos.begin()];
+	}
+}
+
+void ReadStore::getQual(long k, std::string& qual) const {
+	assert(hasQual);
+	qual.assign(quals.begin() + starts[k], quals.begin() + starts[k + 1]);
+}
+
+#endif /* READSTORE_H_ */
@@ -86,6 +86,12 @@ public:
 		return (dir == 0 ? get_base_id(seq[pos]) : get_rbase_id(seq[totLen - pos - 1]));
 	}
 
+	// the base aligned to read base 0 of a read of length len at pos; read base i is ptr[i] (dir 0) or the complement of ptr[-i] (dir 1)
+	const char* getBasePtr(int pos, int len, int dir) const {
+		assert(pos >= 0 && len >= 0 && pos + len <= totLen);
+		return (dir == 0 ? seq.data() + pos : seq.data() + (totLen - pos - 1));
+	}
+
 	bool getMask(int seedPos) const {
 		assert(seedPos >= 0 && seedPos < totLen);
 		return fmasks[seedPos / NBITS] & mask_codes[seedPos % NBITS];
@@ -23,9 +23,12 @@
 #include "SingleHit.h"
 #include "PairedEndHit.h"
 
+#include "BgzfReader.h"
+
 class SamParser {
 public:
-	SamParser(char, const char*, Refs&, const char* = 0);
+	// nThreads : number of threads inflating BAM input
+	SamParser(char, const char*, Refs&, const char* = 0, int = 1);
 	~SamParser();
 
 	/**
@@ -46,11 +49,21 @@ public:
 		strcpy(rtTag, tag);
 	}
 
+	// also write every alignment read to copyF as a BAM file, for input that can be read only once (e.g. SAM from a pipe)
+	void setCopy(const char* copyF);
+
 private:
 	samfile_t *sam_in;
 	bam_header_t *header;
 	bam1_t *b, *b2;
+	BgzfReader *bamIn; // reads the alignments of a BAM file with several threads, NULL if samread reads them
+	samfile_t *copy_out; // NULL if no copy is written
 
+	int readNext(bam1_t *b) {
+		int ret = (bamIn != NULL ? bamIn->readBam(b) : samread(sam_in, b));
+		if (ret >= 0 && copy_out != NULL) samwrite(copy_out, b);
+		return ret;
+	}
 
 	//tag used by aligner
 	static char rtTag[STRLEN];
@@ -60,12 +73,30 @@ private:
 		return ((b->core.flag & 0x0010) ? -1 : 1);
 	}
 
-	std::string getName(const bam1_t* b) {
-		return std::string((char*)bam1_qname(b));
+	const char* getName(const bam1_t* b) {
+		return (const char*)bam1_qname(b);
 	}
 
-	std::string getReadSeq(const bam1_t*);
-	std::string getQScore(const bam1_t*);
+	// whether b belongs to read, compared in place
+	bool sameName(const Read& read, const bam1_t* b) {
+		return !strcmp(read.getName().c_str(), getName(b));
+	}
+
+	/*
+	  Sequences and quality scores are decoded into buffers owned by the parser, so that parsing a record
+	  does not allocate once the buffers are large enough. BAM packs two bases into a byte; pairTable[byte]
+	  gives both bases of a byte, rcPairTable[byte] their reverse complement in reversed order, so a
+	  reverse strand read is decoded in one pass. Bases other than A, C, G, T and N are rejected.
+	 */
+	static char baseTable[16], rcBaseTable[16]; // 0 : code RSEM does not accept
+	static char pairTable[256][2], rcPairTable[256][2];
+	static bool badPair[256]; // true if either base of the byte is not accepted
+	static void buildTables();
+
+	std::string seqBufs[2], qualBufs[2]; // [0] : the read or mate 1, [1] : mate 2
+
+	void getReadSeq(const bam1_t*, std::string&);
+	void getQScore(const bam1_t*, std::string&);
 
 	//0 ~ N0 1 ~ N1 2 ~ N2
 	int getReadType(const bam1_t*);
@@ -78,8 +109,28 @@ private:
 
 char SamParser::rtTag[STRLEN] = ""; // default : no tag, thus no Type 2 reads
 
+char SamParser::baseTable[16] = {};
+char SamParser::rcBaseTable[16] = {};
+char SamParser::pairTable[256][2] = {};
+char SamParser::rcPairTable[256][2] = {};
+bool SamParser::badPair[256] = {};
+
+void SamParser::buildTables() {
+	if (baseTable[1] != 0) return; // built already
+
+	baseTable[1] = 'A'; baseTable[2] = 'C'; baseTable[4] = 'G'; baseTable[8] = 'T'; baseTable[15] = 'N';
+	rcBaseTable[1] = 'T'; rcBaseTable[2] = 'G'; rcBaseTable[4] = 'C'; rcBaseTable[8] = 'A'; rcBaseTable[15] = 'N';
+
+	for (int i = 0; i < 256; i++) {
+		int hi = i >> 4, lo = i & 15; // the first base is in the high nibble
+		pairTable[i][0] = baseTable[hi]; pairTable[i][1] = baseTable[lo];
+		rcPairTable[i][0] = rcBaseTable[lo]; rcPairTable[i][1] = rcBaseTable[hi];
+		badPair[i] = (baseTable[hi] == 0 || baseTable[lo] == 0);
+	}
+}
+
 // aux, if not 0, points to the file name of fn_list
-SamParser::SamParser(char inpType, const char* inpF, Refs& refs, const char* aux) {
+SamParser::SamParser(char inpType, const char* inpF, Refs& refs, const char* aux, int nThreads) {
 	switch(inpType) {
 	case 'b': sam_in = samopen(inpF, "rb", aux); break;
 	case 's': sam_in = samopen(inpF, "r", aux); break;
@@ -106,30 +157,46 @@ SamParser::SamParser(char inpType, const char* inpF, Refs& refs, const char* aux
 
     b = bam_init1();
     b2 = bam_init1();
+
+    buildTables();
+
+    // samopen has read the header, the threads start at the first alignment
+    copy_out = NULL;
+
+    bamIn = NULL;
+    if (inpType == 'b' && nThreads > 1 && !bam_is_be && strcmp(inpF, "-"))
+    	bamIn = new BgzfReader(inpF, bgzf_tell(sam_in->x.bam), nThreads);
 }
 
 SamParser::~SamParser() {
+	if (bamIn != NULL) delete bamIn;
+	if (copy_out != NULL) samclose(copy_out);
 	samclose(sam_in);
 	bam_destroy1(b);
 	bam_destroy1(b2);
 }
 
+void SamParser::setCopy(const char* copyF) {
+	copy_out = samopen(copyF, "wb1", header); // the copy is read once more, favor speed over size
+	if (copy_out == 0) { fprintf(stderr, "Cannot create %s!\n", copyF); exit(-1); }
+}
+
 // If sam_read1 returns 0 , what does it mean?
 //Assume b.core.tid is 0-based
 int SamParser::parseNext(SingleRead& read, SingleHit& hit) {
 	int val; // return value
-	bool canR = (samread(sam_in, b) >= 0);
+	bool canR = (readNext(b) >= 0);
 	if (!canR) return -1;
 
 	if (b->core.flag & 0x0001) { fprintf(stderr, "Find a paired end read in the file!\n"); exit(-1); }
 	//(b->core.flag & 0x0100) &&  && !(b->core.flag & 0x0004)
 
 	int readType = getReadType(b);
-	std::string name = getName(b);
 
-	if (readType != 1 || (readType == 1 && read.getName().compare(name) != 0)) {
+	if (readType != 1 || (readType == 1 && !sameName(read, b))) {
 		val = readType;
-		read = SingleRead(name, getReadSeq(b));
+		getReadSeq(b, seqBufs[0]);
+		read.set(getName(b), seqBufs[0]);
 	}
 	else val = 5;
 
@@ -149,18 +216,19 @@ int SamParser::parseNext(SingleRead& read, SingleHit& hit) {
 
 int SamParser::parseNext(SingleReadQ& read, SingleHit& hit) {
 	int val;
-	bool canR = (samread(sam_in, b) >= 0);
+	bool canR = (readNext(b) >= 0);
 	if (!canR) return -1;
 
 	if (b->core.flag & 0x0001) { fprintf(stderr, "Find a paired end read in the file!\n"); exit(-1); }
 	//assert(!(b->core.flag & 0x0001)); //(b->core.flag & 0x0100) &&  && !(b->core.flag & 0x0004)
 
 	int readType = getReadType(b);
-	std::string name = getName(b);
 
-	if (readType != 1 || (readType == 1 && read.getName().compare(name) != 0)) {
+	if (readType != 1 || (readType == 1 && !sameName(read, b))) {
 		val = readType;
-		read = SingleReadQ(name, getReadSeq(b), getQScore(b));
+		getReadSeq(b, seqBufs[0]);
+		getQScore(b, qualBufs[0]);
+		read.set(getName(b), seqBufs[0], qualBufs[0]);
 	}
 	else val = 5;
 
@@ -181,7 +249,7 @@ int SamParser::parseNext(SingleReadQ& read, SingleHit& hit) {
 //Assume whether aligned or not , two mates of paired-end reads are always get together
 int SamParser::parseNext(PairedEndRead& read, PairedEndHit& hit) {
 	int val;
-	bool canR = ((samread(sam_in, b) >= 0) && (samread(sam_in, b2) >= 0));
+	bool canR = ((readNext(b) >= 0) && (readNext(b2) >= 0));
 	if (!canR) return -1;
 
 	if (!((b->core.flag & 0x0001) && (b2->core.flag & 0x0001))) {
@@ -201,13 +269,12 @@ int SamParser::parseNext(PairedEndRead& read, PairedEndHit& hit) {
 	else return 4; // If lose mate info, discard. is it necessary?
 
 	int readType = getReadType(mp1, mp2);
-	std::string name = getName(mp1);
 
-	if (readType != 1 || (readType == 1 && read.getName().compare(name) != 0)) {
+	if (readType != 1 || (readType == 1 && !sameName(read, mp1))) {
 		val = readType;
-		SingleRead mate1(getName(mp1), getReadSeq(mp1));
-		SingleRead mate2(getName(mp2), getReadSeq(mp2));
-		read = PairedEndRead(mate1, mate2);
+		getReadSeq(mp1, seqBufs[0]);
+		getReadSeq(mp2, seqBufs[1]);
+		read.set(getName(mp1), seqBufs[0], getName(mp2), seqBufs[1]);
 	}
 	else val = 5;
 
@@ -232,7 +299,7 @@ int SamParser::parseNext(PairedEndRead& read, PairedEndHit& hit) {
 
 int SamParser::parseNext(PairedEndReadQ& read, PairedEndHit& hit) {
 	int val;
-	bool canR = ((samread(sam_in, b) >= 0) && (samread(sam_in, b2) >= 0));
+	bool canR = ((readNext(b) >= 0) && (readNext(b2) >= 0));
 	if (!canR) return -1;
 
 	if (!((b->core.flag & 0x0001) && (b2->core.flag & 0x0001))) {
@@ -252,13 +319,12 @@ int SamParser::parseNext(PairedEndReadQ& read, PairedEndHit& hit) {
 	else return 4;
 
 	int readType = getReadType(mp1, mp2);
-	std::string name = getName(mp1);
 
-	if (readType != 1 || (readType == 1 && read.getName().compare(name) != 0)) {
+	if (readType != 1 || (readType == 1 && !sameName(read, mp1))) {
 		val = readType;
-		SingleReadQ mate1(getName(mp1), getReadSeq(mp1), getQScore(mp1));
-		SingleReadQ mate2(getName(mp2), getReadSeq(mp2), getQScore(mp2));
-		read = PairedEndReadQ(mate1, mate2);
+		getReadSeq(mp1, seqBufs[0]); getQScore(mp1, qualBufs[0]);
+		getReadSeq(mp2, seqBufs[1]); getQScore(mp2, qualBufs[1]);
+		read.set(getName(mp1), seqBufs[0], qualBufs[0], getName(mp2), seqBufs[1], qualBufs[1]);
 	}
 	else val = 5;
 
@@ -281,62 +347,50 @@ int SamParser::parseNext(PairedEndReadQ& read, PairedEndHit& hit) {
 	return val;
 }
 
-inline std::string SamParser::getReadSeq(const bam1_t* b) {
-	uint8_t *p = bam1_seq(b);
-	std::string readseq = "";
-	char base = 0;
+inline void SamParser::getReadSeq(const bam1_t* b, std::string& readseq) {
+	const uint8_t *p = bam1_seq(b);
+	int len = b->core.l_qseq, nPairs = len >> 1;
+	bool bad = false;
+
+	readseq.resize(len);
+	if (len == 0) return;
+	char *out = &readseq[0];
 
 	if (getDir(b) < 0) {
-		for (int i = b->core.l_qseq - 1; i >= 0; i--) {
-			switch(bam1_seqi(p, i)) {
-			//case 0 : base = '='; break;
-			case 1 : base = 'T'; break;
-			case 2 : base = 'G'; break;
-			case 4 : base = 'C'; break;
-			case 8 : base = 'A'; break;
-			case 15 : base = 'N'; break;
-			default : assert(false);
-			}
-			readseq.append(1, base);
+		// bases 2i and 2i + 1 go to positions len - 2i - 1 and len - 2i - 2
+		char *q = out + len - 2;
+		for (int i = 0; i < nPairs; i++, q -= 2) {
+			q[0] = rcPairTable[p[i]][0]; q[1] = rcPairTable[p[i]][1];
+			bad |= badPair[p[i]];
 		}
+		if (len & 1) { out[0] = rcBaseTable[p[nPairs] >> 4]; bad |= (out[0] == 0); }
 	}
 	else {
-		for (int i = 0; i < b->core.l_qseq; i++) {
-			switch(bam1_seqi(p, i)) {
-			//case 0 : base = '='; break;
-			case 1 : base = 'A'; break;
-			case 2 : base = 'C'; break;
-			case 4 : base = 'G'; break;
-			case 8 : base = 'T'; break;
-			case 15 : base = 'N'; break;
-			default : assert(false);
-			}
-			readseq.append(1, base);
+		char *q = out;
+		for (int i = 0; i < nPairs; i++, q += 2) {
+			q[0] = pairTable[p[i]][0]; q[1] = pairTable[p[i]][1];
+			bad |= badPair[p[i]];
 		}
+		if (len & 1) { out[len - 1] = baseTable[p[nPairs] >> 4]; bad |= (out[len - 1] == 0); }
 	}
 
-	return readseq;
+	if (bad) { fprintf(stderr, "Read %s contains a base other than A, C, G, T and N!\n", getName(b)); exit(-1); }
 }
 
-inline std::string SamParser::getQScore(const bam1_t* b) {
-	uint8_t *p = bam1_qual(b);
-	std::string qscore = "";
+inline void SamParser::getQScore(const bam1_t* b, std::string& qscore) {
+	const uint8_t *p = bam1_qual(b);
+	int len = b->core.l_qseq;
+
+	qscore.resize(len);
+	if (len == 0) return;
+	char *out = &qscore[0];
 
 	if (getDir(b) > 0) {
-		for (int i = 0; i < b->core.l_qseq; i++) {
-			qscore.append(1, (char)(*p + 33));
-			++p;
-		}
+		for (int i = 0; i < len; i++) out[i] = (char)(p[i] + 33);
 	}
 	else {
-		p = p + b->core.l_qseq - 1;
-		for (int i = 0; i < b->core.l_qseq; i++) {
-			qscore.append(1, (char)(*p + 33));
-			--p;
-		}
+		for (int i = 0; i < len; i++) out[i] = (char)(p[len - 1 - i] + 33);
 	}
-
-	return qscore;
 }
 
 //0 ~ N0 , 1 ~ N1, 2 ~ N2
@@ -13,6 +13,7 @@
 #include "Orientation.h"
 #include "LenDist.h"
 #include "RSPD.h"
+#include "MateLenTables.h"
 #include "Profile.h"
 #include "NoiseProfile.h"
 
@@ -24,6 +25,9 @@
 #include "ReadReader.h"
 
 #include "simul.h"
+#include "PerfLog.h"
+#include "WorkerPool.h"
+#include "MWCalculator.h"
 
 class SingleModel {
 public:
@@ -43,6 +47,7 @@ public:
 
 		mean = -1.0; sd = 0.0;
 		mw = NULL;
+		pool = NULL;
 
 		seedLen = 0;
 	}
@@ -59,6 +64,7 @@ public:
 
 		ori = NULL; gld = NULL; mld = NULL; rspd = NULL; pro = NULL; npro = NULL;
 		mw = NULL;
+		pool = NULL;
 
 		if (isMaster) {
 			gld = new LenDist(params.minL, params.maxL);
@@ -110,19 +116,11 @@ public:
 		double value;
 
 		if (mld != NULL) {
-			int minL = std::max(readLen, gld->getMinL());
-			int maxL = std::min(totLen - pos, gld->getMaxL());
-			int pfpos; // possible fpos for fragment
-			value = 0.0;
-			for (int fragLen = minL; fragLen <= maxL; fragLen++) {
-				pfpos = (dir == 0 ? pos : totLen - pos - fragLen);
-				effL = std::min(fullLen, totLen - fragLen + 1);
-				value += gld->getAdjustedProb(fragLen, totLen) * rspd->getAdjustedProb(pfpos, effL, fullLen) * mld->getAdjustedProb(readLen, fragLen);
-			}
+			value = mlt.getSum(sid, fullLen, totLen, dir, pos, readLen);
 		}
 		else {
 			effL = std::min(fullLen, totLen - readLen + 1);
-			value = gld->getAdjustedProb(readLen, totLen) * rspd->getAdjustedProb(fpos, effL, fullLen);
+			value = gld->getAdjustedProb(readLen, totLen) * rspd->getPreparedProb(sid, fpos, effL, fullLen);
 		}
 
 		prob = ori->getProb(dir) * value * pro->getProb(read.getReadSeq(), ref, pos, dir);
@@ -169,26 +167,8 @@ public:
 				int totLen = ref.getTotLen();
 				int readLen = read.getReadLength();
 
-				int pfpos, effL; 
-
 				if (mld != NULL) {
-					int minL = std::max(readLen, gld->getMinL());
-					int maxL = std::min(totLen - pos, gld->getMaxL());
-					double sum = 0.0;
-					assert(maxL >= minL);
-					std::vector<double> frag_vec(maxL - minL + 1, 0.0);
-
-					for (int fragLen = minL; fragLen <= maxL; fragLen++) {
-						pfpos = totLen - pos - fragLen;
-						effL = std::min(fullLen, totLen - fragLen + 1);
-						frag_vec[fragLen - minL] = gld->getAdjustedProb(fragLen, totLen) * rspd->getAdjustedProb(pfpos, effL, fullLen) * mld->getAdjustedProb(readLen, fragLen);
-						sum += frag_vec[fragLen - minL];
-					}
-					assert(sum >= EPSILON);
-					for (int fragLen = minL; fragLen <= maxL; fragLen++) {
-						pfpos = totLen - pos - fragLen;
-						rspd->update(pfpos, fullLen, frac * (frag_vec[fragLen - minL] / sum));
-					}
+					mlt.updateRSPD(rspd, hit.getSid(), fullLen, totLen, pos, readLen, frac);
 				}
 				else {
 					rspd->update(totLen - pos - readLen, fullLen, frac);
@@ -208,6 +188,10 @@ public:
 
 	void collect(const SingleModel&);
 
+	// what collect() adds up, as a flat array (see Profile::packStats), for adding up across processes
+	int packStats(double* buf) const;
+	int collectStats(const double* buf);
+
 	bool getNeedCalcConPrb() { return needCalcConPrb; }
 	void setNeedCalcConPrb(bool value) { needCalcConPrb = value; }
 
@@ -220,6 +204,9 @@ public:
 	void write(const char*);
 
 	const LenDist& getGLD() { return *gld; }
+	// base-emission profiles, for the emission benchmark (benchEmission.cpp)
+	Profile& getProfile() { return *pro; }
+	NoiseProfile& getNoiseProfile() { return *npro; }
 
 	void startSimulation(simul*, double*);
 	bool simulate(int, SingleRead&, int&);
@@ -230,6 +217,9 @@ public:
 	  return mw;
 	}
 
+	// calcMW runs on the threads of pool from then on, NULL to run it on the calling thread
+	void setWorkerPool(WorkerPool* pool) { this->pool = pool; }
+
 	int getModelType() const { return model_type; }
 
 private:
@@ -256,8 +246,11 @@ private:
 	double *theta_cdf; // for simulation
 
 	double *mw; // for masking
+	WorkerPool *pool; // for calcMW, not owned
+	MateLenTables mlt; // sums over fragment lengths if mld != NULL, master only
 
 	void calcMW();
+	void buildMateLenTables();
 };
 
 void SingleModel::estimateFromReads(const char* readFN) {
@@ -296,6 +289,8 @@ void SingleModel::estimateFromReads(const char* readFN) {
 	}
 	npro->calcInitParams();
 
+	rspd->prepare(refs);
+	buildMateLenTables();
 	mw = new double[M + 1];
 	calcMW();
 }
@@ -311,7 +306,10 @@ void SingleModel::finish() {
 	pro->finish();
 	npro->finish();
 	needCalcConPrb = true;
-	if (estRSPD) calcMW();
+	if (estRSPD) {
+		buildMateLenTables();
+		calcMW();
+	}
 }
 
 void SingleModel::collect(const SingleModel& o) {
@@ -320,6 +318,22 @@ void SingleModel::collect(const SingleModel& o) {
 	npro->collect(*(o.npro));
 }
 
+int SingleModel::packStats(double* buf) const {
+	int n = 0;
+	if (estRSPD) n += rspd->packStats(buf == NULL ? NULL : buf + n);
+	n += pro->packStats(buf == NULL ? NULL : buf + n);
+	n += npro->packStats(buf == NULL ? NULL : buf + n);
+	return n;
+}
+
+int SingleModel::collectStats(const double* buf) {
+	int n = 0;
+	if (estRSPD) n += rspd->collectStats(buf + n);
+	n += pro->collectStats(buf + n);
+	n += npro->collectStats(buf + n);
+	return n;
+}
+
 //Only master node can call
 void SingleModel::read(const char* inpF) {
 	int val;
@@ -349,6 +363,9 @@ void SingleModel::read(const char* inpF) {
 	}
 
 	fclose(fi);
+
+	if (refs != NULL) rspd->prepare(refs);
+	buildMateLenTables();
 }
 
 //Only master node can call. Only be called at EM.cpp
@@ -445,67 +462,16 @@ void SingleModel::finishSimulation() {
 }
 
 void SingleModel::calcMW() {
-	double probF, probR;
-
+	PerfScope scope("calcMW");
 	assert((mld == NULL ? gld->getMinL() : mld->getMinL()) >= seedLen);
-  
-	memset(mw, 0, sizeof(double) * (M + 1));
-	mw[0] = 1.0;
-
-	probF = ori->getProb(0);
-	probR = ori->getProb(1);
 
-	for (int i = 1; i <= M; i++) {
-		RefSeq& ref = refs->getRef(i);
-		int totLen = ref.getTotLen();
-		int fullLen = ref.getFullLen();
-		double value = 0.0;
-		int minL, maxL;
-		int effL, pfpos;
-		int end = std::min(fullLen, totLen - seedLen + 1);
-		double factor;
-
-		for (int seedPos = 0; seedPos < end; seedPos++)
-			if (ref.getMask(seedPos)) {
-				//forward
-				minL = gld->getMinL();
-				maxL = std::min(gld->getMaxL(), totLen - seedPos);
-				pfpos = seedPos;
-				for (int fragLen = minL; fragLen <= maxL; fragLen++) {
-					effL = std::min(fullLen, totLen - fragLen + 1);
-					factor = (mld == NULL ? 1.0 : mld->getAdjustedCumulativeProb(std::min(mld->getMaxL(), fragLen), fragLen));
-					value += probF * gld->getAdjustedProb(fragLen, totLen) * rspd->getAdjustedProb(pfpos, effL, fullLen) * factor;
-				}
-				//reverse
-				minL = gld->getMinL();
-				maxL = std::min(gld->getMaxL(), seedPos + seedLen);
-				for (int fragLen = minL; fragLen <= maxL; fragLen++) {
-					pfpos = seedPos - (fragLen - seedLen);
-					effL = std::min(fullLen, totLen - fragLen + 1);
-					factor = (mld == NULL ? 1.0 : mld->getAdjustedCumulativeProb(std::min(mld->getMaxL(), fragLen), fragLen));
-					value += probR * gld->getAdjustedProb(fragLen, totLen) * rspd->getAdjustedProb(pfpos, effL, fullLen) * factor;
-				}
-			}
-    
-		//for reverse strand masking
-		for (int seedPos = end; seedPos <= totLen - seedLen; seedPos++) {
-			minL = std::max(gld->getMinL(), seedPos + seedLen - fullLen + 1);
-			maxL = std::min(gld->getMaxL(), seedPos + seedLen);
-			for (int fragLen = minL; fragLen <= maxL; fragLen++) {
-				pfpos = seedPos - (fragLen - seedLen);
-				effL = std::min(fullLen, totLen - fragLen + 1);
-				factor = (mld == NULL ? 1.0 : mld->getAdjustedCumulativeProb(std::min(mld->getMaxL(), fragLen), fragLen));
-				value += probR * gld->getAdjustedProb(fragLen, totLen) * rspd->getAdjustedProb(pfpos, effL, fullLen) * factor;
-			}
-		}
-
-		mw[i] = 1.0 - value;
+	MWCalculator calc(refs, gld, rspd, seedLen, false, ori->getProb(0), ori->getProb(1));
+	calc.calc(mw, pool);
+}
 
-		if (mw[i] < 1e-8) {
-			//      fprintf(stderr, "Warning: %dth reference sequence is masked for almost all positions!\n", i);
-			mw[i] = 0.0;
-		}
-	}
+// the tables depend on gld, mld and rspd, so they are rebuilt whenever one of those changes
+void SingleModel::buildMateLenTables() {
+	if (mld != NULL && refs != NULL) mlt.build(gld, mld, rspd, refs);
 }
 
 #endif /* SINGLEMODEL_H_ */
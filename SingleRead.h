@@ -10,6 +10,7 @@
 
 #include "utils.h"
 #include "Read.h"
+#include "ReadStore.h"
 
 class SingleRead : public Read {
 public:
@@ -20,8 +21,18 @@ public:
 		this->len = readseq.length();
 	}
 
+	// same as assigning SingleRead(name, readseq), but reuses the memory this read already holds
+	void set(const char* name, const std::string& readseq) {
+		this->name = name;
+		this->readseq = readseq;
+		this->len = readseq.length();
+		low_quality = false;
+	}
+
 	bool read(int argc, std::istream* argv[], int flags = 7);
 	void write(int argc, std::ostream* argv[]);
+	bool read(const ReadStore& store, long k, int flags = 7); // load record k of an in-memory store, the name is not kept
+	bool write(ReadStore& store) const;
 
 	const int getReadLength() const { return len; /*readseq.length();*/ } // If need memory and .length() are guaranteed O(1), use statement in /* */
 	const std::string& getReadSeq() const { return readseq; }
@@ -54,6 +65,18 @@ void SingleRead::write(int argc, std::ostream* argv[]) {
 	(*argv[0])<<">"<<name<<std::endl<<readseq<<std::endl;
 }
 
+bool SingleRead::read(const ReadStore& store, long k, int flags) {
+	name = "";
+	len = store.getLength(k);
+	if (flags & 1) { store.getSeq(k, readseq); } else { readseq = ""; }
+
+	return true;
+}
+
+bool SingleRead::write(ReadStore& store) const {
+	return store.push(readseq, NULL);
+}
+
 //calculate if this read is low quality
 void SingleRead::calc_lq(bool hasPolyA, int seedLen) {
 	low_quality = false;
@@ -10,6 +10,7 @@
 
 #include "utils.h"
 #include "Read.h"
+#include "ReadStore.h"
 
 class SingleReadQ : public Read {
 public:
@@ -21,8 +22,19 @@ public:
 		this->len = readseq.length();
 	}
 
+	// same as assigning SingleReadQ(name, readseq, qscore), but reuses the memory this read already holds
+	void set(const char* name, const std::string& readseq, const std::string& qscore) {
+		this->name = name;
+		this->readseq = readseq;
+		this->qscore = qscore;
+		this->len = readseq.length();
+		low_quality = false;
+	}
+
 	bool read(int argc, std::istream* argv[], int flags = 7);
 	void write(int argc, std::ostream* argv[]);
+	bool read(const ReadStore& store, long k, int flags = 7); // load record k of an in-memory store, the name is not kept
+	bool write(ReadStore& store) const;
 
 	int getReadLength() const { return len; }
 	const std::string& getReadSeq() const { return readseq; }
@@ -59,6 +71,19 @@ void SingleReadQ::write(int argc, std::ostream* argv[]) {
 	(*argv[0])<<"@"<<name<<std::endl<<readseq<<std::endl<<"+\n"<<qscore<<std::endl;
 }
 
+bool SingleReadQ::read(const ReadStore& store, long k, int flags) {
+	name = "";
+	len = store.getLength(k);
+	if (flags & 1) { store.getSeq(k, readseq); } else { readseq = ""; }
+	if (flags & 2) { store.getQual(k, qscore); } else { qscore = ""; }
+
+	return true;
+}
+
+bool SingleReadQ::write(ReadStore& store) const {
+	return store.push(readseq, &qscore);
+}
+
 //calculate if this read is low quality
 void SingleReadQ::calc_lq(bool hasPolyA, int seedLen) {
 	low_quality = false;
@@ -0,0 +1,167 @@
+#ifndef WORKERPOOL_H_
+#define WORKERPOOL_H_
+
+#include<cstdio>
+#include<cassert>
+#include<sys/time.h>
+#include<pthread.h>
+
+#include "my_assert.h"
+
+/**
+A fixed set of long-lived worker threads. Each call to run() hands args[i] to worker i
+and returns only after every worker has finished, so one call is one round followed by a barrier.
+Threads are created once in the constructor and joined in the destructor.
+ */
+class WorkerPool {
+public:
+	typedef void* (*TaskType)(void*);
+
+	WorkerPool(int nThreads);
+	~WorkerPool();
+
+	void run(TaskType task, void** args);
+
+	int getNThreads() const { return nThreads; }
+
+	// wall time (in seconds) worker id spent on its task during the last run
+	double getWorkerTime(int id) const { assert(id >= 0 && id < nThreads); return workerTimes[id]; }
+
+	// wall time (in seconds) of the last run, from publishing the task to the barrier
+	double getRoundTime() const { return roundTime; }
+
+	static double getTime() {
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + tv.tv_usec * 1e-6;
+	}
+
+private:
+	struct Worker {
+		WorkerPool *pool;
+		int id;
+	};
+
+	int nThreads;
+	pthread_t *threads;
+	Worker *workers;
+	double *workerTimes, roundTime;
+
+	pthread_mutex_t lock;
+	pthread_cond_t startCond, doneCond;
+
+	TaskType task;
+	void **args;
+	long round; // increased each time run() publishes a task
+	int nRunning; // number of workers which have not finished the current round
+	bool stop;
+
+	static void* workerLoop(void*);
+};
+
+WorkerPool::WorkerPool(int nThreads) {
+	int rc;
+	pthread_attr_t attr;
+
+	assert(nThreads > 0);
+	this->nThreads = nThreads;
+
+	threads = new pthread_t[nThreads];
+	workers = new Worker[nThreads];
+	workerTimes = new double[nThreads];
+	for (int i = 0; i < nThreads; i++) workerTimes[i] = 0.0;
+	roundTime = 0.0;
+
+	task = NULL; args = NULL;
+	round = 0; nRunning = 0;
+	stop = false;
+
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&startCond, NULL);
+	pthread_cond_init(&doneCond, NULL);
+
+	/* set thread attribute to be joinable */
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+	for (int i = 0; i < nThreads; i++) {
+		workers[i].pool = this;
+		workers[i].id = i;
+		rc = pthread_create(&threads[i], &attr, workerLoop, (void*)(&workers[i]));
+		pthread_assert(rc, "pthread_create", "Cannot create worker thread " + itos(i) + " (numbered from 0)!");
+	}
+
+	/* destroy attribute */
+	pthread_attr_destroy(&attr);
+}
+
+WorkerPool::~WorkerPool() {
+	int rc;
+	void *status;
+
+	pthread_assert(pthread_mutex_lock(&lock), "pthread_mutex_lock", "Error occurred while acquiring the lock!");
+	stop = true;
+	pthread_cond_broadcast(&startCond);
+	pthread_assert(pthread_mutex_unlock(&lock), "pthread_mutex_unlock", "Error occurred while releasing the lock!");
+
+	for (int i = 0; i < nThreads; i++) {
+		rc = pthread_join(threads[i], &status);
+		pthread_assert(rc, "pthread_join", "Cannot join worker thread " + itos(i) + " (numbered from 0)!");
+	}
+
+	pthread_cond_destroy(&startCond);
+	pthread_cond_destroy(&doneCond);
+	pthread_mutex_destroy(&lock);
+
+	delete[] threads;
+	delete[] workers;
+	delete[] workerTimes;
+}
+
+void WorkerPool::run(TaskType task, void** args) {
+	double startTime = getTime();
+
+	pthread_assert(pthread_mutex_lock(&lock), "pthread_mutex_lock", "Error occurred while acquiring the lock!");
+	assert(nRunning == 0);
+	this->task = task;
+	this->args = args;
+	nRunning = nThreads;
+	++round;
+	pthread_cond_broadcast(&startCond);
+	while (nRunning > 0) pthread_cond_wait(&doneCond, &lock);
+	pthread_assert(pthread_mutex_unlock(&lock), "pthread_mutex_unlock", "Error occurred while releasing the lock!");
+
+	roundTime = getTime() - startTime;
+}
+
+void* WorkerPool::workerLoop(void* arg) {
+	Worker *worker = (Worker*)arg;
+	WorkerPool *pool = worker->pool;
+	long seen = 0; // last round this worker has done
+	TaskType task;
+	void *taskArg;
+	double startTime;
+
+	pthread_assert(pthread_mutex_lock(&pool->lock), "pthread_mutex_lock", "Error occurred while acquiring the lock!");
+	while (true) {
+		while (!pool->stop && pool->round == seen) pthread_cond_wait(&pool->startCond, &pool->lock);
+		if (pool->stop) break;
+
+		seen = pool->round;
+		task = pool->task;
+		taskArg = pool->args[worker->id];
+		pthread_assert(pthread_mutex_unlock(&pool->lock), "pthread_mutex_unlock", "Error occurred while releasing the lock!");
+
+		startTime = getTime();
+		task(taskArg);
+
+		pthread_assert(pthread_mutex_lock(&pool->lock), "pthread_mutex_lock", "Error occurred while acquiring the lock!");
+		pool->workerTimes[worker->id] = getTime() - startTime;
+		if (--pool->nRunning == 0) pthread_cond_signal(&pool->doneCond);
+	}
+	pthread_assert(pthread_mutex_unlock(&pool->lock), "pthread_mutex_unlock", "Error occurred while releasing the lock!");
+
+	return NULL;
+}
+
+#endif /* WORKERPOOL_H_ */
@@ -0,0 +1,241 @@
+/*
+  rsem-bench-emission : times the base-emission kernels of Emission.h against the per-base loops they replaced, on
+  the alignments and the learned model of a sample that rsem-run-em has processed, and checks that both agree.
+
+  For every hit, each aligned mate is scored by the profile of the model (getProb) and added into it (update); for
+  every read, each mate is scored by and added into the noise profile. The old loops are kept here as they were,
+  running on a copy of the same tables.
+ */
+
+#include<cmath>
+#include<cstdio>
+#include<cstring>
+#include<cstdlib>
+#include<cassert>
+#include<string>
+#include<vector>
+#include<algorithm>
+
+#include "utils.h"
+#include "my_assert.h"
+#include "Read.h"
+#include "SingleRead.h"
+#include "SingleReadQ.h"
+#include "PairedEndRead.h"
+#include "PairedEndReadQ.h"
+#include "SingleHit.h"
+#include "PairedEndHit.h"
+#include "Profile.h"
+#include "QProfile.h"
+#include "NoiseProfile.h"
+#include "NoiseQProfile.h"
+#include "SingleModel.h"
+#include "SingleQModel.h"
+#include "PairedEndModel.h"
+#include "PairedEndQModel.h"
+#include "RefSeq.h"
+#include "Refs.h"
+#include "ReadReader.h"
+#include "HitFile.h"
+#include "PerfLog.h"
+
+using namespace std;
+
+const double FRAC = 0.25; // added by update
+
+// one mate to score: its bases, its quality scores (NULL without qualities) and, unless it is a noise item, where it aligns
+struct EmissionItem {
+	const string *seq, *qual;
+	const RefSeq *ref;
+	int pos, dir;
+
+	EmissionItem(const string* seq, const string* qual, const RefSeq* ref = NULL, int pos = 0, int dir = 0) : seq(seq), qual(qual), ref(ref), pos(pos), dir(dir) {}
+};
+
+int read_type, nRepeats;
+char refF[STRLEN], modelF[STRLEN], datF[STRLEN], imdName[STRLEN], statName[STRLEN];
+
+Refs refs;
+HitFile datFile;
+
+void addItems(Refs& refs, const SingleRead& read, const SingleHit& hit, vector<EmissionItem>& items, vector<EmissionItem>& noiseItems) {
+	if (noiseItems.empty() || noiseItems.back().seq != &read.getReadSeq()) noiseItems.push_back(EmissionItem(&read.getReadSeq(), NULL));
+	items.push_back(EmissionItem(&read.getReadSeq(), NULL, &refs.getRef(hit.getSid()), hit.getPos(), hit.getDir()));
+}
+
+void addItems(Refs& refs, const SingleReadQ& read, const SingleHit& hit, vector<EmissionItem>& items, vector<EmissionItem>& noiseItems) {
+	if (noiseItems.empty() || noiseItems.back().seq != &read.getReadSeq()) noiseItems.push_back(EmissionItem(&read.getReadSeq(), &read.getQScore()));
+	items.push_back(EmissionItem(&read.getReadSeq(), &read.getQScore(), &refs.getRef(hit.getSid()), hit.getPos(), hit.getDir()));
+}
+
+// mate 2 aligns to the other strand, at the far end of the fragment (see PairedEndModel::getConPrb)
+template<class MateType>
+void addPairedItems(Refs& refs, const MateType& mate1, const MateType& mate2, const string* qual1, const string* qual2, const PairedEndHit& hit, vector<EmissionItem>& items, vector<EmissionItem>& noiseItems) {
+	RefSeq &ref = refs.getRef(hit.getSid());
+	if (noiseItems.empty() || noiseItems.back().seq != &mate2.getReadSeq()) {
+		noiseItems.push_back(EmissionItem(&mate1.getReadSeq(), qual1));
+		noiseItems.push_back(EmissionItem(&mate2.getReadSeq(), qual2));
+	}
+	items.push_back(EmissionItem(&mate1.getReadSeq(), qual1, &ref, hit.getPos(), hit.getDir()));
+	items.push_back(EmissionItem(&mate2.getReadSeq(), qual2, &ref, ref.getTotLen() - hit.getPos() - hit.getInsertL(), !hit.getDir()));
+}
+
+void addItems(Refs& refs, const PairedEndRead& read, const PairedEndHit& hit, vector<EmissionItem>& items, vector<EmissionItem>& noiseItems) {
+	addPairedItems(refs, read.getMate1(), read.getMate2(), NULL, NULL, hit, items, noiseItems);
+}
+
+void addItems(Refs& refs, const PairedEndReadQ& read, const PairedEndHit& hit, vector<EmissionItem>& items, vector<EmissionItem>& noiseItems) {
+	addPairedItems(refs, read.getMate1(), read.getMate2(), &read.getMate1().getQScore(), &read.getMate2().getQScore(), hit, items, noiseItems);
+}
+
+// the calls of the profiles under test
+double newProb(Profile& pro, const EmissionItem& it) { return pro.getProb(*it.seq, *it.ref, it.pos, it.dir); }
+double newProb(QProfile& pro, const EmissionItem& it) { return pro.getProb(*it.seq, *it.qual, *it.ref, it.pos, it.dir); }
+double newProb(NoiseProfile& pro, const EmissionItem& it) { return pro.getProb(*it.seq); }
+double newProb(NoiseQProfile& pro, const EmissionItem& it) { return pro.getProb(*it.seq, *it.qual); }
+
+void newUpdate(Profile& pro, const EmissionItem& it) { pro.update(*it.seq, *it.ref, it.pos, it.dir, FRAC); }
+void newUpdate(QProfile& pro, const EmissionItem& it) { pro.update(*it.seq, *it.qual, *it.ref, it.pos, it.dir, FRAC); }
+void newUpdate(NoiseProfile& pro, const EmissionItem& it) { pro.update(*it.seq, FRAC); }
+void newUpdate(NoiseQProfile& pro, const EmissionItem& it) { pro.update(*it.seq, *it.qual, FRAC); }
+
+// the loops the kernels replaced, on the flat table p[row][refBase][readBase] (p[row][readBase] for noise items)
+inline int oldIndex(const EmissionItem& it, int i) {
+	int row = (it.qual != NULL ? (*it.qual)[i] - 33 : i);
+	assert(row >= 0 && row <= 93);
+	if (it.ref == NULL) return (it.qual != NULL ? row * 5 : 0) + get_base_id((*it.seq)[i]);
+	return (row * 5 + it.ref->get_id(i + it.pos, it.dir)) * 5 + get_base_id((*it.seq)[i]);
+}
+
+double oldProb(const double* p, const EmissionItem& it) {
+	double prob = 1.0;
+	int len = it.seq->size();
+	for (int i = 0; i < len; i++) prob *= p[oldIndex(it, i)];
+	return prob;
+}
+
+void oldUpdate(double* p, const EmissionItem& it) {
+	int len = it.seq->size();
+	for (int i = 0; i < len; i++) p[oldIndex(it, i)] += FRAC;
+}
+
+double maxRelDiff(double a, double b, double mx) {
+	double d = fabs(a - b), m = max(fabs(a), fabs(b));
+	return (m > 0.0 ? max(mx, d / m) : mx);
+}
+
+// times getProb and update of pro, old against new, best of nRepeats passes over items
+template<class ProfileType>
+void bench(const char* name, ProfileType& pro, const vector<EmissionItem>& items) {
+	int n = items.size();
+	long long nBases = 0;
+	double t, bestOld[2], bestNew[2], sumOld = 0.0, sumNew = 0.0, diffProb = 0.0, diffUpdate = 0.0;
+
+	if (n == 0) return;
+	for (int i = 0; i < n; i++) nBases += items[i].seq->size();
+
+	vector<double> p(pro.packStats(NULL)), u(p.size()), v(p.size());
+	pro.packStats(&p[0]);
+
+	for (int i = 0; i < n; i++) diffProb = maxRelDiff(oldProb(&p[0], items[i]), newProb(pro, items[i]), diffProb);
+
+	bestOld[0] = bestOld[1] = bestNew[0] = bestNew[1] = 1e100;
+	for (int r = 0; r < nRepeats; r++) {
+		t = PerfLog::getTime();
+		for (int i = 0; i < n; i++) sumOld += oldProb(&p[0], items[i]);
+		bestOld[0] = min(bestOld[0], PerfLog::getTime() - t);
+
+		t = PerfLog::getTime();
+		for (int i = 0; i < n; i++) sumNew += newProb(pro, items[i]);
+		bestNew[0] = min(bestNew[0], PerfLog::getTime() - t);
+
+		// both tables start from 0 in every pass, the last pass is compared
+		u.assign(u.size(), 0.0);
+		t = PerfLog::getTime();
+		for (int i = 0; i < n; i++) oldUpdate(&u[0], items[i]);
+		bestOld[1] = min(bestOld[1], PerfLog::getTime() - t);
+
+		pro.init();
+		t = PerfLog::getTime();
+		for (int i = 0; i < n; i++) newUpdate(pro, items[i]);
+		bestNew[1] = min(bestNew[1], PerfLog::getTime() - t);
+
+		// the next getProb pass needs the probabilities back
+		pro.packStats(&v[0]);
+		pro.init();
+		pro.collectStats(&p[0]);
+	}
+
+	for (int i = 0; i < (int)u.size(); i++) diffUpdate = maxRelDiff(u[i], v[i], diffUpdate);
+
+	printf("%-14s getProb : old %6.2f ns/base, new %6.2f ns/base, %5.2fx, max rel diff %.2g (sums %.10g %.10g)\n", name,
+	       bestOld[0] / nBases * 1e9, bestNew[0] / nBases * 1e9, bestOld[0] / bestNew[0], diffProb, sumOld, sumNew);
+	printf("%-14s update  : old %6.2f ns/base, new %6.2f ns/base, %5.2fx, max rel diff %.2g\n", name,
+	       bestOld[1] / nBases * 1e9, bestNew[1] / nBases * 1e9, bestOld[1] / bestNew[1], diffUpdate);
+}
+
+template<class ReadType, class HitType, class ModelType>
+void run() {
+	ModelType model;
+	int s, N;
+	char readFs[2][STRLEN];
+	vector<ReadType> reads;
+	vector<EmissionItem> items, noiseItems;
+
+	model.read(modelF);
+
+	datFile.map(datF, sizeof(HitType));
+	general_assert(datFile.getReadType() == read_type, "Data file (.dat) does not have the right read type!");
+	N = datFile.getN();
+	int *offsets = datFile.getOffsets();
+	HitType *hits = (HitType*)datFile.getHits();
+
+	// items point into reads, so every read is in place before the first item is made
+	genReadFileNames(imdName, 1, read_type, s, readFs);
+	ReadReader<ReadType> reader(s, readFs);
+	reads.resize(N);
+	for (int i = 0; i < N; i++) general_assert(reader.next(reads[i]), "The alignable reads and " + cstrtos(datF) + " do not match!");
+
+	for (int i = 0; i < N; i++)
+		for (int j = offsets[i]; j < offsets[i + 1]; j++) addItems(refs, reads[i], hits[j], items, noiseItems);
+
+	printf("%d reads, %d hits, %d mates scored by the profile, %d by the noise profile; best of %d passes\n", N, datFile.getNHits(), (int)items.size(), (int)noiseItems.size(), nRepeats);
+#ifdef EMISSION_X86
+	printf("kernel : %s\n", emissionUseAVX2 ? "AVX2" : "scalar");
+#endif
+
+	bench("profile", model.getProfile(), items);
+	bench("noise profile", model.getNoiseProfile(), noiseItems);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 5) {
+		printf("Usage : rsem-bench-emission refName read_type sampleName sampleToken [-r #Repeats]\n\n");
+		printf("  Run rsem-run-em on the sample first, the bench reads its .model, .dat and alignable reads.\n");
+		exit(-1);
+	}
+
+	read_type = atoi(argv[2]);
+	general_assert(read_type >= 0 && read_type <= 3, "Read type should be 0, 1, 2 or 3!");
+	nRepeats = 3;
+	for (int i = 5; i < argc; i++)
+		if (!strcmp(argv[i], "-r") && i + 1 < argc) nRepeats = atoi(argv[i + 1]);
+	general_assert(nRepeats >= 1, "Number of repeats should be at least 1!");
+
+	sprintf(imdName, "%s.temp/%s", argv[3], argv[4]);
+	sprintf(statName, "%s.stat/%s", argv[3], argv[4]);
+	sprintf(refF, "%s.seq", argv[1]);
+	sprintf(modelF, "%s.model", statName);
+	sprintf(datF, "%s.dat", imdName);
+
+	refs.loadRefs(refF);
+
+	switch(read_type) {
+	case 0 : run<SingleRead, SingleHit, SingleModel>(); break;
+	case 1 : run<SingleReadQ, SingleHit, SingleQModel>(); break;
+	case 2 : run<PairedEndRead, PairedEndHit, PairedEndModel>(); break;
+	case 3 : run<PairedEndReadQ, PairedEndHit, PairedEndQModel>(); break;
+	}
+
+	return 0;
+}
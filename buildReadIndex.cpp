@@ -6,31 +6,20 @@
 #include<iostream>
 
 #include "utils.h"
+#include "ReadIndex.h"
 using namespace std;
 
 int gap;
 bool hasQ;
 
 void buildIndex(char* readF, int gap, bool hasQ) {
-	int nPos;
-	long nReads;
 	bool success;
 	string line;
-	char idxF[STRLEN];
-	char buf[sizeof(nReads) + sizeof(gap) + sizeof(nPos)];
-	streampos startPos;
-
-	sprintf(idxF, "%s.ridx", readF);
 
 	ifstream fin(readF);
 	if (!fin.is_open()) { fprintf(stderr, "Cannot open %s! It may not exist.\n", readF); exit(-1); }
-	ofstream fout(idxF, ios::binary);
-
-	startPos = fout.tellp();
-	memset(buf, 0, sizeof(buf));
-	fout.write((char*)buf, sizeof(buf));
+	ReadIndexWriter writer(readF, gap);
 
-	nReads = 0; nPos = 0;
 	do {
 		streampos pos = fin.tellg();
 		success = true;
@@ -47,22 +36,13 @@ void buildIndex(char* readF, int gap, bool hasQ) {
 			if (!success) continue;
 		}
 
-		if (nReads % gap == 0) {
-			++nPos;
-			fout.write((char*)&pos, sizeof(pos));
-		}
-		++nReads;
+		writer.add(pos);
 
-		if (verbose && nReads % 1000000 == 0) { printf("FIN %lld\n", (long long)nReads); }
+		if (verbose && writer.nReads % 1000000 == 0) { printf("FIN %lld\n", (long long)writer.nReads); }
 	} while (success);
 
-	fout.seekp(startPos);
-	fout.write((char*)&nReads, sizeof(nReads));
-	fout.write((char*)&gap, sizeof(gap));
-	fout.write((char*)&nPos, sizeof(nPos));
-
+	writer.close();
 	fin.close();
-	fout.close();
 
 	if (verbose) { printf("Build Index %s is Done!\n", readF); }
 }
@@ -11,6 +11,7 @@
 #include<map>
 
 #include "utils.h"
+#include "my_assert.h"
 
 #include "GroupInfo.h"
 
@@ -25,7 +26,10 @@
 #include "PairedEndHit.h"
 
 #include "HitContainer.h"
+#include "HitFile.h"
+#include "ReadIndex.h"
 #include "SamParser.h"
+#include "AsyncWriter.h"
 
 using namespace std;
 
@@ -33,19 +37,24 @@ int read_type; // 0 SingleRead, 1 SingleReadQ, 2 PairedEndRead, 3 PairedEndReadQ
 int N[3]; // note, N = N0 + N1 + N2 , but may not be equal to the total number of reads in data
 int nHits; // # of hits
 int nUnique, nMulti, nIsoMulti;
+int nThreads;
+int gap; // write the read index of the alignable reads, one position every gap reads, if gap > 0
 char fn_list[STRLEN];
 char refF[STRLEN], groupF[STRLEN];
 char imdName[STRLEN];
 char datF[STRLEN], cntF[STRLEN];
+char copyF[STRLEN]; // if not empty, the alignments are copied here as they are read
 
 Refs refs;
 GroupInfo gi;
 
 SamParser *parser;
-ofstream hit_out;
+AsyncWriter *writer; // writes the read files and the hit file
 
 int n_os; // number of ostreams
 ostream *cat[3][2]; // cat : category  1-dim 0 N0 1 N1 2 N2; 2-dim  0 mate1 1 mate2
+AsyncFileBuf *bufs[3][2];
+ReadIndexWriter *indices[2]; // indices of the alignable read files
 char readOutFs[3][2][STRLEN];
 
 map<int, int> counter;
@@ -55,9 +64,16 @@ void init(const char* imdName, char alignFType, const char* alignF) {
 
 	char* aux = 0;
 	if (strcmp(fn_list, "")) aux = fn_list;
-	parser = new SamParser(alignFType, alignF, refs, aux);
+	/*
+	  Parsing is a pipeline: for BAM input, nThreads threads inflate the file (see BgzfReader.h); this thread
+	  decodes the alignments and formats the reads and hits; a writer thread writes the output files.
+	 */
+	parser = new SamParser(alignFType, alignF, refs, aux, nThreads);
+	if (strcmp(copyF, "")) parser->setCopy(copyF);
+	writer = new AsyncWriter(nThreads > 1);
 
 	memset(cat, 0, sizeof(cat));
+	memset(bufs, 0, sizeof(bufs));
 	memset(readOutFs, 0, sizeof(readOutFs));
 
 	int tmp_n_os = -1;
@@ -67,19 +83,36 @@ void init(const char* imdName, char alignFType, const char* alignF) {
 
 		assert(tmp_n_os < 0 || tmp_n_os == n_os); tmp_n_os = n_os;
 
-		for (int j = 0; j < n_os; j++)
-			cat[i][j] = new ofstream(readOutFs[i][j]);
+		for (int j = 0; j < n_os; j++) {
+			FILE *fo = fopen(readOutFs[i][j], "w");
+			general_assert(fo != NULL, "Cannot create " + cstrtos(readOutFs[i][j]) + "!");
+			bufs[i][j] = new AsyncFileBuf(writer, fo, true);
+			cat[i][j] = new ostream(bufs[i][j]);
+		}
 	}
 
+	// the parser knows where each read goes, so the index costs no extra pass over the read files
+	memset(indices, 0, sizeof(indices));
+	if (gap > 0)
+		for (int j = 0; j < n_os; j++) indices[j] = new ReadIndexWriter(readOutFs[1][j], gap);
+
 	counter.clear();
 }
 
+// record where the next alignable read starts in each read file
+void addToIndices() {
+	for (int j = 0; j < n_os; j++) indices[j]->add(cat[1][j]->tellp());
+}
+
 //Do not allow duplicate for unalignable reads and supressed reads in SAM input
 template<class ReadType, class HitType>
 void parseIt(SamParser *parser) {
-	// record_val & record_read are copies of val & read for record purpose
+	HitFileWriter<HitType> hit_out(datF, read_type, writer);
+
+	// record_val is the type of the read whose hits are being collected; a read is written out as soon as its
+	// first record is parsed, as the read files and the hit file are independent, the output is the same
 	int val, record_val;
-	ReadType read, record_read;
+	ReadType read;
 	HitType hit;
 	HitContainer<HitType> hits;
 
@@ -92,18 +125,13 @@ void parseIt(SamParser *parser) {
 	record_val = -2; //indicate no recorded read now
 	while ((val = parser->parseNext(read, hit)) >= 0) {
 		if (val >= 0 && val <= 2) {
-			// flush out previous read's info if needed
-			if (record_val >= 0) {
-				record_read.write(n_os, cat[record_val]);
-				++N[record_val];
-			}
 			// flush out previous read's hits if the read is alignable reads
 			if (record_val == 1) {
 				hits.updateRI();
 				nHits += hits.getNHits();
 				nMulti += hits.calcNumGeneMultiReads(gi);
 				nIsoMulti += hits.calcNumIsoformMultiReads();
-				hits.write(hit_out);
+				hit_out.write(hits);
 
 				iter = counter.find(hits.getNHits());
 				if (iter != counter.end()) {
@@ -116,7 +144,10 @@ void parseIt(SamParser *parser) {
 
 			hits.clear();
 			record_val = val;
-			record_read = read; // no pointer, thus safe
+
+			if (val == 1 && gap > 0) addToIndices();
+			read.write(n_os, cat[val]);
+			++N[val];
 		}
 
 		if (val == 1 || val == 5) {
@@ -127,17 +158,12 @@ void parseIt(SamParser *parser) {
 		if (verbose && (cnt % 1000000 == 0)) { printf("Parsed %lld entries\n", cnt); }
 	}
 
-	if (record_val >= 0) {
-		record_read.write(n_os, cat[record_val]);
-		++N[record_val];
-	}
-
 	if (record_val == 1) {
 		hits.updateRI();
 		nHits += hits.getNHits();
 		nMulti += hits.calcNumGeneMultiReads(gi);
 		nIsoMulti += hits.calcNumIsoformMultiReads();
-		hits.write(hit_out);
+		hit_out.write(hits);
 
 		iter = counter.find(hits.getNHits());
 		if (iter != counter.end()) {
@@ -149,17 +175,30 @@ void parseIt(SamParser *parser) {
 	}
 
 	nUnique = N[1] - nMulti;
+
+	hit_out.close();
+	assert(hit_out.getN() == N[1] && hit_out.getNHits() == nHits);
 }
 
 void release() {
-	for (int i = 0; i < 3; i++) {
+	for (int i = 0; i < 3; i++)
 		for (int j = 0; j < n_os; j++) {
-			((ofstream*)cat[i][j])->close();
 			delete cat[i][j];
+			delete bufs[i][j];
+		}
+	delete writer; // returns once every file is written and closed
+
+	for (int j = 0; j < n_os; j++)
+		if (indices[j] != NULL) {
+			indices[j]->close();
+			delete indices[j];
 		}
+
+	for (int i = 0; i < 3; i++) {
 		if (N[i] > 0) continue;
 		for (int j = 0; j < n_os; j++) {
 			remove(readOutFs[i][j]); //delete if the file is empty
+			if (i == 1 && gap > 0) remove((cstrtos(readOutFs[i][j]) + ".ridx").c_str());
 		}
 	}
 	delete parser;
@@ -169,12 +208,15 @@ int main(int argc, char* argv[]) {
 	bool quiet = false;
 
 	if (argc < 6) {
-		printf("Usage : rsem-parse-alignments refName sampleName sampleToken alignFType('s' for sam, 'b' for bam) alignF [-t Type] [-l fn_list] [-tag tagName] [-q]\n");
+		printf("Usage : rsem-parse-alignments refName sampleName sampleToken alignFType('s' for sam, 'b' for bam) alignF [-t Type] [-l fn_list] [-tag tagName] [-p nThreads] [-ridx gap] [-copy copyF] [-q]\n");
 		exit(-1);
 	}
 
 	strcpy(fn_list, "");
+	strcpy(copyF, "");
 	read_type = 0;
+	nThreads = 1;
+	gap = 0;
 	if (argc > 6) {
 		for (int i = 6; i < argc; i++) {
 			if (!strcmp(argv[i], "-t")) {
@@ -186,10 +228,15 @@ int main(int argc, char* argv[]) {
 			if (!strcmp(argv[i], "-tag")) {
 				SamParser::setReadTypeTag(argv[i + 1]);
 			}
+			if (!strcmp(argv[i], "-p")) { nThreads = atoi(argv[i + 1]); }
+			if (!strcmp(argv[i], "-ridx")) { gap = atoi(argv[i + 1]); }
+			if (!strcmp(argv[i], "-copy")) { strcpy(copyF, argv[i + 1]); }
 			if (!strcmp(argv[i], "-q")) { quiet = true; }
 		}
 	}
 
+	general_assert(nThreads > 0, "Number of threads should be bigger than 0!");
+
 	verbose = !quiet;
 
 	sprintf(refF, "%s.seq", argv[1]);
@@ -203,12 +250,6 @@ int main(int argc, char* argv[]) {
 
 	init(imdName, argv[4][0], argv[5]);
 
-	hit_out.open(datF);
-
-	string firstLine(59, ' ');
-	firstLine.append(1, '\n');		//May be dangerous!
-	hit_out<<firstLine;
-
 	switch(read_type) {
 	case 0 : parseIt<SingleRead, SingleHit>(parser); break;
 	case 1 : parseIt<SingleReadQ, SingleHit>(parser); break;
@@ -216,11 +257,6 @@ int main(int argc, char* argv[]) {
 	case 3 : parseIt<PairedEndReadQ, PairedEndHit>(parser); break;
 	}
 
-	hit_out.seekp(0, ios_base::beg);
-	hit_out<<N[1]<<" "<<nHits<<" "<<read_type;
-
-	hit_out.close();
-
 	//cntF for statistics of alignments file
 	ofstream fout(cntF);
 	fout<<N[0]<<" "<<N[1]<<" "<<N[2]<<" "<<(N[0] + N[1] + N[2])<<endl;